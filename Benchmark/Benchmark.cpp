@@ -0,0 +1,85 @@
+#include "Benchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <thread>
+
+namespace
+{
+	std::atomic<uint64_t> Allocations = 0;
+}
+
+void* operator new(std::size_t Size)
+{
+	Allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* Ptr = std::malloc(Size ? Size : 1))
+	{
+		return Ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* Ptr) noexcept
+{
+	std::free(Ptr);
+}
+
+void operator delete(void* Ptr, std::size_t) noexcept
+{
+	std::free(Ptr);
+}
+
+uint64_t Benchmark::GetAllocations()
+{
+	return Allocations.load(std::memory_order_relaxed);
+}
+
+// Benchmark [json|csv] [output file|-] [all|tasks|queue] [max threads]
+// Results go to stdout when no file is given. Returns 2, when the queue lost or duplicated an element.
+int main(int argc, char** argv)
+{
+	const bool bCsv = argc > 1 && !std::strcmp(argv[1], "csv");
+	const char* Suite = argc > 3 ? argv[3] : "all";
+	const uint32_t MaxThreads = argc > 4 ? static_cast<uint32_t>(std::atoi(argv[4])) : std::max(1u, std::thread::hardware_concurrency());
+
+	Benchmark::Report Report;
+	uint64_t QueueErrors = 0;
+	if (!std::strcmp(Suite, "all") || !std::strcmp(Suite, "tasks"))
+	{
+		Benchmark::RunTaskBenchmarks(Report);
+	}
+	if (!std::strcmp(Suite, "all") || !std::strcmp(Suite, "queue"))
+	{
+		QueueErrors = Benchmark::RunQueueBenchmarks(Report, std::max(1u, MaxThreads));
+	}
+
+	std::ofstream File;
+	if (argc > 2 && std::strcmp(argv[2], "-"))
+	{
+		File.open(argv[2]);
+		if (!File)
+		{
+			std::cerr << "Cannot open " << argv[2] << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& Out = File.is_open() ? static_cast<std::ostream&>(File) : std::cout;
+	if (bCsv)
+	{
+		Report.WriteCsv(Out);
+	}
+	else
+	{
+		Report.WriteJson(Out);
+	}
+	if (QueueErrors)
+	{
+		std::cerr << "LockFreeQueue lost or duplicated " << QueueErrors << " elements" << std::endl;
+		return 2;
+	}
+	return 0;
+}
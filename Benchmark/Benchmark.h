@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace Benchmark
+{
+	// Number of allocations made by any thread since the start. Counted by the replaced global operator new.
+	uint64_t GetAllocations();
+
+	struct Result
+	{
+		std::string Name;
+		std::vector<std::pair<std::string, double>> Metrics;
+	};
+
+	// Collects results and writes them in a machine-readable form.
+	class Report
+	{
+		std::vector<Result> Results;
+
+	public:
+		Result& Add(std::string Name)
+		{
+			Results.push_back(Result{ std::move(Name), {} });
+			return Results.back();
+		}
+
+		//	{"results": [{"name": "UniqueTask/Resume", "ns_per_op": 2.1, ...}, ...]}
+		void WriteJson(std::ostream& Out) const
+		{
+			Out << "{\n  \"results\": [";
+			for (std::size_t Index = 0; Index < Results.size(); Index++)
+			{
+				const Result& Entry = Results[Index];
+				Out << (Index ? ",\n" : "\n") << "    {\"name\": \"" << Entry.Name << "\"";
+				for (const auto& [Metric, Value] : Entry.Metrics)
+				{
+					Out << ", \"" << Metric << "\": " << Value;
+				}
+				Out << "}";
+			}
+			Out << "\n  ]\n}\n";
+		}
+
+		// One row per metric: name,metric,value
+		void WriteCsv(std::ostream& Out) const
+		{
+			Out << "name,metric,value\n";
+			for (const Result& Entry : Results)
+			{
+				for (const auto& [Metric, Value] : Entry.Metrics)
+				{
+					Out << Entry.Name << "," << Metric << "," << Value << "\n";
+				}
+			}
+		}
+	};
+
+	constexpr uint32_t kRepetitions = 5;
+
+	// Runs Body(Ops) once to warm up and kRepetitions times measured.
+	// Reports median and minimal ns/op and allocations/op.
+	template <typename Fn>
+	Result& Measure(Report& Out, std::string Name, uint64_t Ops, Fn&& Body)
+	{
+		using Clock = std::chrono::steady_clock;
+		Body(Ops);
+
+		std::vector<double> NsPerOp;
+		uint64_t Allocations = 0;
+		for (uint32_t Repetition = 0; Repetition < kRepetitions; Repetition++)
+		{
+			const uint64_t AllocationsBefore = GetAllocations();
+			const Clock::time_point Start = Clock::now();
+			Body(Ops);
+			const Clock::time_point End = Clock::now();
+			Allocations += GetAllocations() - AllocationsBefore;
+			NsPerOp.push_back(std::chrono::duration<double, std::nano>(End - Start).count() / Ops);
+		}
+		std::sort(NsPerOp.begin(), NsPerOp.end());
+
+		Result& Entry = Out.Add(std::move(Name));
+		Entry.Metrics.emplace_back("ns_per_op", NsPerOp[NsPerOp.size() / 2]);
+		Entry.Metrics.emplace_back("ns_per_op_min", NsPerOp.front());
+		Entry.Metrics.emplace_back("allocs_per_op", static_cast<double>(Allocations) / (Ops * kRepetitions));
+		Entry.Metrics.emplace_back("ops", static_cast<double>(Ops));
+		return Entry;
+	}
+
+	// Keeps the value observable, so the measured code isn't optimized out.
+	template <typename T>
+	void DoNotOptimize(const T& Value)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		static_cast<void>(*reinterpret_cast<const volatile char*>(&Value));
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : : "g"(&Value) : "memory");
+#endif
+	}
+
+	void RunTaskBenchmarks(Report& Out);
+
+	// Sweeps producers and consumers (1..MaxThreads), element sizes and block sizes.
+	// Checks every element is popped exactly once. Returns number of lost and duplicated elements.
+	uint64_t RunQueueBenchmarks(Report& Out, uint32_t MaxThreads);
+}
@@ -0,0 +1,335 @@
+#include "Benchmark.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "LockFreeQueue.h"
+#include "MPMCQueue.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	// The queue counts elements in 16 bits. Producers back off, so the consumers can't fall that far behind.
+	// Latency includes the time spent in the queue, producers run ahead up to this limit.
+	constexpr uint32_t kMaxInFlight = 32 * 1024;
+	constexpr uint64_t kItemsPerRun = 200'000;
+	// Capacity of the wide queue runs
+	constexpr uint32_t kWideMaxNum = 1 << 20;
+	// A lost element would keep the consumers waiting forever.
+	constexpr auto kLossTimeout = std::chrono::seconds(5);
+
+	template <uint32_t kBytes>
+	struct Payload
+	{
+		static_assert(kBytes >= 16);
+
+		uint64_t Id = 0;
+		int64_t EnqueuedNs = 0;
+		std::array<std::byte, kBytes - 16> Padding{};
+	};
+
+	int64_t NowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	struct QueueRunStats
+	{
+		double OpsPerSecond = 0;
+		double P50Ns = 0;
+		double P99Ns = 0;
+		uint64_t Lost = 0;
+		uint64_t Duplicated = 0;
+		uint32_t Blocks = 0;
+	};
+
+	// Batch > 1: producers submit batches and consumers claim batches (when the queue supports it)
+	template <typename QueueType>
+	QueueRunStats RunQueue(uint32_t Producers, uint32_t Consumers, uint32_t Batch)
+	{
+		using Element = typename QueueType::ValueType;
+		QueueType Queue;
+
+		const uint64_t ItemsPerProducer = kItemsPerRun / Producers;
+		const uint64_t Total = ItemsPerProducer * Producers;
+		std::unique_ptr<std::atomic<uint8_t>[]> Seen(new std::atomic<uint8_t>[Total]);
+		for (uint64_t Index = 0; Index < Total; Index++)
+		{
+			Seen[Index].store(0, std::memory_order_relaxed);
+		}
+		std::atomic<uint64_t> Consumed = 0;
+		std::atomic<uint64_t> Duplicated = 0;
+		std::atomic<uint32_t> ProducersDone = 0;
+		std::atomic<bool> bStart = false;
+		std::vector<std::vector<int64_t>> Latencies(Consumers);
+
+		std::vector<std::thread> Threads;
+		for (uint32_t Producer = 0; Producer < Producers; Producer++)
+		{
+			Threads.emplace_back([&, Producer]()
+			{
+				while (!bStart.load(std::memory_order_acquire)) {}
+				for (uint64_t Seq = 0; Seq < ItemsPerProducer; Seq += Batch)
+				{
+					while (Queue.Num() > kMaxInFlight)
+					{
+						std::this_thread::yield();
+					}
+					const uint64_t FirstId = Producer * ItemsPerProducer + Seq;
+					const int64_t EnqueuedNs = NowNs();
+					if (Batch == 1)
+					{
+						Element Item;
+						Item.Id = FirstId;
+						Item.EnqueuedNs = EnqueuedNs;
+						Queue.Enqueue(Item);
+						continue;
+					}
+					const uint32_t Num = static_cast<uint32_t>(std::min<uint64_t>(Batch, ItemsPerProducer - Seq));
+					Queue.EnqueueBatch(Num, [&](uint32_t Index)
+					{
+						Element Item;
+						Item.Id = FirstId + Index;
+						Item.EnqueuedNs = EnqueuedNs;
+						return Item;
+					});
+				}
+				ProducersDone.fetch_add(1, std::memory_order_release);
+			});
+		}
+		for (uint32_t Consumer = 0; Consumer < Consumers; Consumer++)
+		{
+			Threads.emplace_back([&, Consumer]()
+			{
+				std::vector<int64_t>& Latency = Latencies[Consumer];
+				Latency.reserve(Total / Consumers + 1);
+				Clock::time_point IdleSince = Clock::now();
+				while (!bStart.load(std::memory_order_acquire)) {}
+				auto Consume = [&](const Element& Item)
+				{
+					Latency.push_back(NowNs() - Item.EnqueuedNs);
+					if (Item.Id >= Total || Seen[Item.Id].fetch_add(1, std::memory_order_relaxed))
+					{
+						Duplicated.fetch_add(1, std::memory_order_relaxed);
+					}
+				};
+				while (Consumed.load(std::memory_order_relaxed) < Total)
+				{
+					uint32_t Num = 0;
+					if (Batch == 1)
+					{
+						std::optional<Element> Item = Queue.Pop();
+						if (Item)
+						{
+							Consume(*Item);
+							Num = 1;
+						}
+					}
+					else
+					{
+						Num = Queue.PopBatch(Batch, Consume);
+					}
+					if (!Num)
+					{
+						if (ProducersDone.load(std::memory_order_acquire) < Producers)
+						{
+							IdleSince = Clock::now();
+						}
+						else if (Clock::now() - IdleSince > kLossTimeout)
+						{
+							break;
+						}
+						std::this_thread::yield();
+						continue;
+					}
+					Consumed.fetch_add(Num, std::memory_order_relaxed);
+					IdleSince = Clock::now();
+				}
+			});
+		}
+
+		const Clock::time_point Start = Clock::now();
+		bStart.store(true, std::memory_order_release);
+		for (std::thread& Thread : Threads)
+		{
+			Thread.join();
+		}
+		const double Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+
+		QueueRunStats Stats;
+		for (uint64_t Index = 0; Index < Total; Index++)
+		{
+			Stats.Lost += !Seen[Index].load(std::memory_order_relaxed);
+		}
+		Stats.Duplicated = Duplicated.load();
+		Stats.OpsPerSecond = Consumed.load() / Seconds;
+		if constexpr (requires { Queue.NumAllocatedBlocks(); })
+		{
+			Stats.Blocks = Queue.NumAllocatedBlocks();
+		}
+
+		std::vector<int64_t> All;
+		for (const std::vector<int64_t>& Latency : Latencies)
+		{
+			All.insert(All.end(), Latency.begin(), Latency.end());
+		}
+		if (!All.empty())
+		{
+			auto Percentile = [&](double Fraction) -> double
+			{
+				auto It = All.begin() + static_cast<std::ptrdiff_t>(Fraction * (All.size() - 1));
+				std::nth_element(All.begin(), It, All.end());
+				return static_cast<double>(*It);
+			};
+			Stats.P50Ns = Percentile(0.5);
+			Stats.P99Ns = Percentile(0.99);
+		}
+		return Stats;
+	}
+
+	uint64_t AddQueueMetrics(Benchmark::Result& Entry, const QueueRunStats& Stats)
+	{
+		Entry.Metrics.emplace_back("ops_per_s", Stats.OpsPerSecond);
+		Entry.Metrics.emplace_back("latency_p50_ns", Stats.P50Ns);
+		Entry.Metrics.emplace_back("latency_p99_ns", Stats.P99Ns);
+		Entry.Metrics.emplace_back("blocks", Stats.Blocks);
+		Entry.Metrics.emplace_back("lost", static_cast<double>(Stats.Lost));
+		Entry.Metrics.emplace_back("duplicated", static_cast<double>(Stats.Duplicated));
+		return Stats.Lost + Stats.Duplicated;
+	}
+
+	// Common interface of the queues: element type and batches
+	template <typename Element, uint32_t kBlockSize, uint32_t kMaxNum, bool kBounded, bool kPadded>
+	struct BlockQueue : LockFreeQueue<Element, kBlockSize, kMaxNum, kBounded, kPadded>
+	{
+		using ValueType = Element;
+
+		template <typename Construct>
+		void EnqueueBatch(uint32_t Num, Construct&& construct) { this->EnqueueBulk(Num, construct); }
+
+		template <typename Func>
+		uint32_t PopBatch(uint32_t MaxNum, Func&& func) { return this->PopBulk(MaxNum, func); }
+	};
+
+	template <typename Element, uint32_t kCapacity>
+	struct RingQueue : MPMCQueue<Element, kCapacity>
+	{
+		using ValueType = Element;
+
+		template <typename Construct>
+		void EnqueueBatch(uint32_t Num, Construct&& construct)
+		{
+			for (uint32_t Pushed = 0; Pushed < Num;)
+			{
+				const uint32_t Added = this->TryEnqueueBulk(Num - Pushed, [&](uint32_t Index) { return construct(Pushed + Index); });
+				Pushed += Added;
+				if (!Added)
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		// Consumers claim single elements
+		template <typename Func>
+		uint32_t PopBatch(uint32_t, Func&& func)
+		{
+			return this->Pop([&](Element& Item) { func(Item); return true; }) ? 1 : 0;
+		}
+	};
+
+	// kMaxNum above 65535 selects the wide queue. A bounded queue blocks the producers at kMaxNum.
+	template <uint32_t kBytes, uint32_t kBlockSize, uint32_t kMaxNum = UINT16_MAX, bool kBounded = false, bool kPadded = false>
+	uint64_t AddQueueRun(Benchmark::Report& Out, uint32_t Producers, uint32_t Consumers, uint32_t Batch = 1)
+	{
+		const QueueRunStats Stats = RunQueue<BlockQueue<Payload<kBytes>, kBlockSize, kMaxNum, kBounded, kPadded>>(Producers, Consumers, Batch);
+		Benchmark::Result& Entry = Out.Add("LockFreeQueue/P" + std::to_string(Producers) + "/C" + std::to_string(Consumers)
+			+ "/Bytes" + std::to_string(kBytes) + "/Block" + std::to_string(kBlockSize) + (Batch > 1 ? "/Batch" + std::to_string(Batch) : "")
+			+ (kMaxNum > UINT16_MAX ? "/Wide" : "") + (kBounded ? "/Bounded" + std::to_string(kMaxNum) : "") + (kPadded ? "/Padded" : ""));
+		return AddQueueMetrics(Entry, Stats);
+	}
+
+	// Bounded, producers wait while it's full
+	template <uint32_t kBytes, uint32_t kCapacity>
+	uint64_t AddRingRun(Benchmark::Report& Out, uint32_t Producers, uint32_t Consumers, uint32_t Batch = 1)
+	{
+		const QueueRunStats Stats = RunQueue<RingQueue<Payload<kBytes>, kCapacity>>(Producers, Consumers, Batch);
+		Benchmark::Result& Entry = Out.Add("MPMCQueue/P" + std::to_string(Producers) + "/C" + std::to_string(Consumers)
+			+ "/Bytes" + std::to_string(kBytes) + "/Capacity" + std::to_string(kCapacity) + (Batch > 1 ? "/Batch" + std::to_string(Batch) : ""));
+		return AddQueueMetrics(Entry, Stats);
+	}
+}
+
+uint64_t Benchmark::RunQueueBenchmarks(Report& Out, uint32_t MaxThreads)
+{
+	std::vector<uint32_t> ThreadCounts;
+	for (uint32_t Count = 1; Count < MaxThreads; Count *= 2)
+	{
+		ThreadCounts.push_back(Count);
+	}
+	ThreadCounts.push_back(MaxThreads);
+
+	uint64_t Errors = 0;
+	for (uint32_t Producers : ThreadCounts)
+	{
+		for (uint32_t Consumers : ThreadCounts)
+		{
+			Errors += AddQueueRun<64, 64>(Out, Producers, Consumers);
+			Errors += AddQueueRun<64, 64, kWideMaxNum>(Out, Producers, Consumers);
+			Errors += AddQueueRun<64, 64, UINT16_MAX, false, true>(Out, Producers, Consumers);
+			// The configuration used by ThreadPool
+			Errors += AddRingRun<64, 1024>(Out, Producers, Consumers);
+		}
+	}
+
+	// Element size and block size, at a moderate contention
+	const uint32_t Threads = std::min(MaxThreads, 4u);
+	Errors += AddQueueRun<16, 64>(Out, Threads, Threads);
+	Errors += AddQueueRun<256, 64>(Out, Threads, Threads);
+	Errors += AddQueueRun<64, 16>(Out, Threads, Threads);
+	Errors += AddQueueRun<64, 256>(Out, Threads, Threads);
+	Errors += AddQueueRun<64, 1024>(Out, Threads, Threads);
+	// Fixed footprint, same capacity as the ring
+	Errors += AddQueueRun<64, 64, 1024, true>(Out, Threads, Threads);
+	// Small elements share cache lines in the dense layout
+	Errors += AddQueueRun<16, 64, UINT16_MAX, false, true>(Out, Threads, Threads);
+
+	// Submission in batches, at the highest fan-out
+	for (uint32_t Batch : { 64u, 512u })
+	{
+		Errors += AddQueueRun<64, 64>(Out, MaxThreads, Threads, Batch);
+		Errors += AddQueueRun<64, 64, kWideMaxNum>(Out, MaxThreads, Threads, Batch);
+		Errors += AddRingRun<64, 1024>(Out, MaxThreads, Threads, Batch);
+	}
+
+	// Single thread, cost of a pop behind a deep backlog
+	auto MeasureBacklog = [&Out](auto& Queue, const std::string& Name, uint32_t Backlog)
+	{
+		for (uint32_t Index = 0; Index < Backlog; Index++)
+		{
+			Queue.Enqueue(Index);
+		}
+		Measure(Out, Name + std::to_string(Backlog), 1'000'000, [&](uint64_t Ops)
+		{
+			for (uint64_t Op = 0; Op < Ops; Op++)
+			{
+				Queue.Enqueue(Op);
+				DoNotOptimize(Queue.Pop());
+			}
+		});
+	};
+	for (uint32_t Backlog : { 0u, 1'000u, 60'000u })
+	{
+		LockFreeQueue<uint64_t, 64> Queue;
+		MeasureBacklog(Queue, "LockFreeQueue/EnqueuePop/Backlog", Backlog);
+	}
+	for (uint32_t Backlog : { 0u, 60'000u, 500'000u })
+	{
+		auto Queue = std::make_unique<LockFreeQueue<uint64_t, 64, kWideMaxNum>>();
+		MeasureBacklog(*Queue, "LockFreeQueue/Wide/EnqueuePop/Backlog", Backlog);
+	}
+	return Errors;
+}
@@ -0,0 +1,216 @@
+#include "Benchmark.h"
+
+#include "UniqueTask.h"
+#include "SharedTask.h"
+#include "BreakIf.h"
+#include "Async.h"
+#include "Generator.h"
+
+using namespace Coroutine;
+
+// Nested awaits through a continuation chain, compared with the polled TaskAwaiter (UniqueTask<int>)
+using ChainedTask = UniqueTask<long>;
+template <> struct Coroutine::ContinuationChain<ChainedTask> : std::true_type {};
+
+namespace
+{
+	UniqueTask<int> ReturnUnique()
+	{
+		co_return 1;
+	}
+
+	SharedTask<int> ReturnShared()
+	{
+		co_return 1;
+	}
+
+	template <typename TaskType>
+	TaskType SuspendForever()
+	{
+		while (true)
+		{
+			co_await std::suspend_always{};
+		}
+	}
+
+	// Depth 1 is the leaf
+	template <typename TaskType>
+	TaskType Nested(uint32_t Depth)
+	{
+		if (Depth <= 1)
+		{
+			while (true)
+			{
+				co_await std::suspend_always{};
+			}
+		}
+		co_await Nested<TaskType>(Depth - 1);
+		co_return 0;
+	}
+
+	UniqueTask<void, int> YieldForever()
+	{
+		for (int Value = 0;; Value++)
+		{
+			co_yield Value;
+		}
+	}
+
+	Generator<int> GenerateForever()
+	{
+		for (int Value = 0;; Value++)
+		{
+			co_yield Value;
+		}
+	}
+
+	// Each call spawns two calls until the depth is reached. Fine-grained calls pushed by the workers.
+	void SpawnTree(std::atomic<uint64_t>& Done, uint32_t Depth)
+	{
+		Done.fetch_add(1, std::memory_order_relaxed);
+		if (Depth)
+		{
+			for (uint32_t Child = 0; Child < 2; Child++)
+			{
+				MultiThread::ThreadPool::Get().Push([&Done, Depth]() { SpawnTree(Done, Depth - 1); });
+			}
+		}
+	}
+
+	template <typename TaskType>
+	void ResumeTimes(TaskType& Task, uint64_t Ops)
+	{
+		for (uint64_t Op = 0; Op < Ops; Op++)
+		{
+			Task.Resume();
+		}
+	}
+}
+
+void Benchmark::RunTaskBenchmarks(Report& Out)
+{
+	Measure(Out, "UniqueTask/CreateDestroy", 1'000'000, [](uint64_t Ops)
+		{
+			for (uint64_t Op = 0; Op < Ops; Op++)
+			{
+				UniqueTask<int> Task = ReturnUnique();
+				DoNotOptimize(Task);
+			}
+		});
+
+	Measure(Out, "SharedTask/CreateDestroy", 1'000'000, [](uint64_t Ops)
+		{
+			for (uint64_t Op = 0; Op < Ops; Op++)
+			{
+				SharedTask<int> Task = ReturnShared();
+				DoNotOptimize(Task);
+			}
+		});
+
+	{
+		UniqueTask<int> Task = SuspendForever<UniqueTask<int>>();
+		Measure(Out, "UniqueTask/Resume", 10'000'000, [&](uint64_t Ops) { ResumeTimes(Task, Ops); });
+	}
+
+	for (uint32_t Depth : { 1, 2, 4, 8, 16, 32 })
+	{
+		UniqueTask<int> Polled = Nested<UniqueTask<int>>(Depth);
+		Measure(Out, "TaskAwaiter/Depth/" + std::to_string(Depth), 1'000'000, [&](uint64_t Ops) { ResumeTimes(Polled, Ops); });
+
+		ChainedTask Chained = Nested<ChainedTask>(Depth);
+		Measure(Out, "ContinuationChain/Depth/" + std::to_string(Depth), 1'000'000, [&](uint64_t Ops) { ResumeTimes(Chained, Ops); });
+	}
+
+	{
+		UniqueTask<int> Task = BreakIf(SuspendForever<UniqueTask<int>>(), []() { return false; });
+		Measure(Out, "BreakIf/Resume", 10'000'000, [&](uint64_t Ops) { ResumeTimes(Task, Ops); });
+	}
+
+	{
+		UniqueTask<void, int> Task = YieldForever();
+		Measure(Out, "Yield/ConsumeYield", 10'000'000, [&](uint64_t Ops)
+			{
+				for (uint64_t Op = 0; Op < Ops; Op++)
+				{
+					Task.Resume();
+					std::optional<int> Value = Task.ConsumeYield();
+					DoNotOptimize(Value);
+				}
+			});
+
+		Generator<int> Values = GenerateForever();
+		Measure(Out, "Yield/Generator", 10'000'000, [&](uint64_t Ops)
+			{
+				for (uint64_t Op = 0; Op < Ops; Op++)
+				{
+					DoNotOptimize(*Values.Advance());
+				}
+			});
+	}
+
+	// The task is woken by the worker through the ReadyQueue, the caller spins on Drain.
+	Measure(Out, "Async/RoundTrip", 1'000, [](uint64_t Ops)
+		{
+			UniqueTask<> Task = [](uint64_t Ops) -> UniqueTask<>
+			{
+				for (uint64_t Op = 0; Op < Ops; Op++)
+				{
+					co_await Async([]() -> int { return 1; });
+				}
+			}(Ops);
+			ReadyQueue Queue;
+			Queue.Add(Task);
+			while (Task.Status() == EStatus::Suspended)
+			{
+				Queue.Drain();
+			}
+		});
+
+	// Calls pushed by other calls (local deques, stolen by idle workers), compared with calls pushed from outside
+	Measure(Out, "ThreadPool/Spawn", (1 << 16) - 1, [](uint64_t Ops)
+		{
+			std::atomic<uint64_t> Done = 0;
+			MultiThread::ThreadPool::Get().Push([&Done]() { SpawnTree(Done, 15); });
+			while (Done.load() != Ops)
+			{
+				std::this_thread::yield();
+			}
+		});
+	Measure(Out, "ThreadPool/Inject", (1 << 16) - 1, [](uint64_t Ops)
+		{
+			std::atomic<uint64_t> Done = 0;
+			for (uint64_t Op = 0; Op < Ops; Op++)
+			{
+				MultiThread::ThreadPool::Get().Push([&Done]() { Done.fetch_add(1, std::memory_order_relaxed); });
+			}
+			while (Done.load() != Ops)
+			{
+				std::this_thread::yield();
+			}
+		});
+
+	// Workers went to sleep, time from Push to the start of the call
+	{
+		using Clock = std::chrono::steady_clock;
+		std::vector<int64_t> Latencies;
+		for (uint32_t Sample = 0; Sample < 200; Sample++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			std::atomic<int64_t> Latency = -1;
+			const Clock::time_point Start = Clock::now();
+			MultiThread::ThreadPool::Get().Push([&]()
+			{
+				Latency.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - Start).count());
+			});
+			while (Latency.load() < 0)
+			{
+				std::this_thread::yield();
+			}
+			Latencies.push_back(Latency.load());
+		}
+		std::sort(Latencies.begin(), Latencies.end());
+		Result& Entry = Out.Add("ThreadPool/WakeFromIdle");
+		Entry.Metrics.emplace_back("latency_p50_ns", static_cast<double>(Latencies[Latencies.size() / 2]));
+		Entry.Metrics.emplace_back("latency_p99_ns", static_cast<double>(Latencies[Latencies.size() * 99 / 100]));
+	}
+}
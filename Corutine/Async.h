@@ -3,15 +3,27 @@
 #include <thread>
 #include <variant>
 #include <utility>
-#include <iostream>
 #include <array>
 #include <deque>
+#include <memory>
 
 #include "Promise.h"
-#include "LockFreeQueue.h"
+#include "InlineFunction.h"
+#include "MPMCQueue.h"
+#include "WorkStealingDeque.h"
+#include "ThreadAffinity.h"
+#include "ReadyQueue.h"
+
+// Inline storage of an AsyncTask call (its captures). A bigger callable is allocated on the heap.
+#ifndef COROUTINE_ASYNC_TASK_CAPACITY
+#define COROUTINE_ASYNC_TASK_CAPACITY 64
+#endif
 
 namespace MultiThread
 {
+	class AsyncTask;
+	class ThreadPool;
+
 	//Sync 2 unmoveable objects, so they can communicate without shader state
 	class base_sync_primitive
 	{
@@ -115,6 +127,7 @@ namespace MultiThread
 
 		AsyncTask* async_task = nullptr;
 		std::atomic<EState> State = EState::NotStarted;
+		std::atomic_flag worker_released_;	// The worker doesn't touch the requester (and OnDone finished)
 
 		void InitUnsafe(AsyncTask* in_task)
 		{
@@ -149,49 +162,69 @@ namespace MultiThread
 
 		template<typename Func> void Start(Func&& fn);
 
+		// OnDone is called on the worker thread, after the state is set to Done. It must not access the requester.
+		// The requester isn't destroyed until OnDone finished. Without a pool, the call is pushed to ThreadPool::Get().
+		template<typename Func, typename DoneFunc> void Start(Func&& fn, DoneFunc&& on_done, ThreadPool* pool = nullptr);
+
 		bool TryCancel();
 
 		~AsyncTaskRequester();
 	};
 
+	// The call is stored in place, the task is constructed in the slot of the pool's queue.
 	class AsyncTask : public base_sync_primitive
 	{
+	public:
+		using Call = Coroutine::InlineFunction<void(), COROUTINE_ASYNC_TASK_CAPACITY>;
+
+	private:
 		const bool needs_sync;
 		AsyncTaskRequester* requester = nullptr;
-		std::function<void()> call;
+		Call call;
 		
 	public:
-		AsyncTask(std::function<void()>&& in_func, AsyncTaskRequester* in_requester = nullptr)
-			: call(in_func), requester(in_requester), needs_sync(!!in_requester)
+		template<typename Func, std::enable_if_t<!std::is_same_v<std::decay_t<Func>, AsyncTask>, int> = 0>
+		AsyncTask(Func&& in_func, AsyncTaskRequester* in_requester = nullptr)
+			: needs_sync(!!in_requester), requester(in_requester)
 		{
-			assert(call);
+			using FuncType = std::decay_t<Func>;
+			if constexpr (sizeof(FuncType) <= COROUTINE_ASYNC_TASK_CAPACITY && alignof(FuncType) <= alignof(std::max_align_t)
+				&& std::is_move_constructible_v<FuncType>)
+			{
+				call.Emplace(std::forward<Func>(in_func));
+			}
+			else
+			{
+				call.Emplace([boxed = std::make_unique<FuncType>(std::forward<Func>(in_func))]() { (*boxed)(); });
+			}
 			if (needs_sync)
 			{
 				requester->InitUnsafe(this);
 			}
-			std::cout << "sizeof(AsyncTask): " << sizeof(AsyncTask) << std::endl;
 		}
 
 		void ReleaseUnsafe() { requester = nullptr; }
 
-		std::function<void()> ForwardFunction()
+		// Returns false, when the requester cancelled the call. Otherwise the requester is Executing from now on.
+		bool TryStart()
 		{
 			if (!needs_sync)
 			{
-				std::function<void()> result;
-				call.swap(result);
-				return result;
+				return true;
 			}
-			
 			if (sync_guard guard(*this, requester); guard)
 			{
 				requester->OnExecution();
 				ReleaseUnsafe();
-				std::function<void()> result;
-				call.swap(result);
-				return result;
+				return true;
 			}
-			return std::function<void()>{};
+			return false;
+		}
+
+		// After TryStart. The call is moved out, so the queue slot is released before the call is executed.
+		Call TakeCall()
+		{
+			return std::move(call);
 		}
 
 		~AsyncTask()
@@ -206,72 +239,321 @@ namespace MultiThread
 		}
 	};
 
+	struct ThreadPoolConfig
+	{
+		uint32_t NumWorkers = 0;		// 0: a worker per CPU (of the NUMA node, or of Cpus)
+		int32_t NumaNode = -1;			// Workers run only on the CPUs of the node, the memory they allocate first stays there
+		bool bPinWorkers = false;		// Each worker runs only on one CPU (worker N on the N-th CPU)
+		std::vector<uint32_t> Cpus = {};	// CPUs for the workers. Empty: all CPUs (of the NUMA node)
+	};
+
+	// Calls pushed by a worker go to its own deque (LIFO, the data of the parent call is still in the cache),
+	// other calls go to the shared injection queue. An idle worker takes from its deque, then from the injection queue,
+	// then steals the oldest call of a random worker.
+	// Independent pools can be created (e.g. for IO and for computations), Async uses Get() unless a pool is given.
 	class ThreadPool
 	{
-		LockFreeQueue<AsyncTask, 64> Messages;
-		std::array<std::thread, 8> Workers;
+		static constexpr uint32_t kLocalCapacity = 256;
+		using LocalQueue = WorkStealingDeque<AsyncTask, kLocalCapacity>;
+
+		MPMCQueue<AsyncTask, 1024> Messages;
+		std::vector<std::unique_ptr<LocalQueue>> LocalMessages;	// Allocated by the workers, so they are local to their NUMA node
+		std::vector<std::thread> Workers;	// Accessed only by the constructor and the destructor
+		uint32_t NumThreads = 0;
+		std::atomic<uint32_t> NumStarted = 0;
 		std::atomic_flag bStopRequest;
 
+		// Idle workers spin for a while (a call usually comes soon), then sleep until Push notifies.
+		static constexpr uint32_t kIdleSpins = 64;
+		std::atomic<uint32_t> NumSleeping = 0;
+		std::atomic<uint32_t> WakeCounter = 0;	// Sleeping workers wait for a change
+
+		// Set on worker threads
+		static inline thread_local ThreadPool* CurrentPool = nullptr;
+		static inline thread_local uint32_t CurrentWorker = 0;
+		// Each thread (workers and callers running calls from a full Push) gets own sequence of victims. Never 0.
+		static inline std::atomic<uint32_t> NextStealSeed = 0;
+		static inline thread_local uint32_t StealSeed = NextStealSeed.fetch_add(0x9E3779B9u, std::memory_order_relaxed) | 1u;
+
+		// The call is moved out, so its slot is released before it's executed.
+		static AsyncTask::Call Take(AsyncTask& Task)
+		{
+			return Task.TryStart() ? Task.TakeCall() : AsyncTask::Call{};
+		}
+
+		// Starts at a random worker, so thieves don't contend on the same victim.
+		std::optional<AsyncTask::Call> Steal()
+		{
+			StealSeed ^= StealSeed << 13;
+			StealSeed ^= StealSeed >> 17;
+			StealSeed ^= StealSeed << 5;
+			const uint32_t First = StealSeed % NumThreads;
+			for (uint32_t Offset = 0; Offset < NumThreads; Offset++)
+			{
+				const uint32_t Victim = (First + Offset) % NumThreads;
+				if (IsWorkerThread() && Victim == CurrentWorker)
+				{
+					continue;
+				}
+				if (std::optional<AsyncTask::Call> Msg = LocalMessages[Victim]->Steal(Take))
+				{
+					return Msg;
+				}
+			}
+			return {};
+		}
+
+		std::optional<AsyncTask::Call> TakeNext()
+		{
+			if (IsWorkerThread())
+			{
+				if (std::optional<AsyncTask::Call> Msg = LocalMessages[CurrentWorker]->Pop(Take))
+				{
+					return Msg;
+				}
+			}
+			if (std::optional<AsyncTask::Call> Msg = Messages.Pop(Take))
+			{
+				return Msg;
+			}
+			return Steal();
+		}
+
+		// Executes the next call. Returns false when there was nothing to execute.
+		// The call may push new calls, its slot is released before, so a full queue can't block it.
+		bool RunOne()
+		{
+			std::optional<AsyncTask::Call> Msg = TakeNext();
+			if (!Msg.has_value())
+			{
+				return false;
+			}
+			if (Msg.value())
+			{
+#if COROUTINE_TRACE
+				const int64_t Begin = Coroutine::Trace::Now();
+				Msg.value()();
+				Coroutine::Trace::Event Event;
+				Event.Name = "AsyncTask";
+				Event.Kind = Coroutine::Trace::EKind::Job;
+				Event.BeginNs = Begin;
+				Event.EndNs = Coroutine::Trace::Now();
+				Coroutine::Trace::Write(Event);
+#else
+				Msg.value()();
+#endif
+			}
+			return true;
+		}
+
+		bool HasMessages() const
+		{
+			if (Messages.Num())
+			{
+				return true;
+			}
+			for (const auto& Local : LocalMessages)
+			{
+				if (Local->Num())
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// The fences order the queue access with NumSleeping: either the worker sees the new call, or Push sees the worker.
+		void WakeWorker()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (NumSleeping.load(std::memory_order_relaxed))
+			{
+				WakeCounter.fetch_add(1, std::memory_order_relaxed);
+				WakeCounter.notify_one();
+			}
+		}
+
+		void Sleep()
+		{
+			// Acquire: the stop request is seen with the counter changed by the destructor
+			const uint32_t Counter = WakeCounter.load(std::memory_order_acquire);
+			NumSleeping.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!HasMessages() && !bStopRequest.test(std::memory_order_relaxed))
+			{
+				WakeCounter.wait(Counter, std::memory_order_relaxed);
+			}
+			NumSleeping.fetch_sub(1, std::memory_order_relaxed);
+		}
+
 	public:
+		// True on the workers of this pool
+		bool IsWorkerThread() const { return CurrentPool == this; }
+
+		uint32_t NumWorkers() const { return NumThreads; }
+
+		// Thread safe. When the queue is full, the caller executes the pending calls meanwhile,
+		// so a call pushing from a worker can't dead-lock the pool.
+		// Called from a worker, the call goes to its own deque, unless the deque is full.
 		template<typename ...Args>
 		void Push(Args&&... args)
 		{
-			Messages.Enqueue(std::forward<Args>(args)...);
+			if (IsWorkerThread() && LocalMessages[CurrentWorker]->TryPush(std::forward<Args>(args)...))
+			{
+				// Idle workers can steal it
+				WakeWorker();
+				return;
+			}
+			while (!Messages.TryEnqueue(std::forward<Args>(args)...))
+			{
+				if (!RunOne())
+				{
+					std::this_thread::yield();
+				}
+			}
+			WakeWorker();
 		}
 
-		ThreadPool()
+		// Pushes Num calls into the injection queue (to be spread over the workers), claiming the queue slots in batches. Construct(Index) returns the AsyncTask, it's constructed in place.
+		template<typename Construct>
+		void PushBulk(uint32_t Num, Construct&& construct)
 		{
-			auto WorkerLoop = [this]()
+			for (uint32_t Pushed = 0; Pushed < Num;)
 			{
+				const uint32_t Added = Messages.TryEnqueueBulk(Num - Pushed, [&](uint32_t Index) { return construct(Pushed + Index); });
+				Pushed += Added;
+				if (!Added && !RunOne())
+				{
+					std::this_thread::yield();
+				}
+			}
+			// Each call may be taken by other worker
+			for (uint32_t Index = 0; Index < std::min(Num, NumThreads); Index++)
+			{
+				WakeWorker();
+			}
+		}
+
+		explicit ThreadPool(const ThreadPoolConfig& Config = {})
+		{
+			const std::vector<uint32_t> Cpus = !Config.Cpus.empty() ? Config.Cpus
+				: Config.NumaNode >= 0 ? GetNumaNodeCpus(static_cast<uint32_t>(Config.NumaNode))
+				: std::vector<uint32_t>{};
+			NumThreads = Config.NumWorkers ? Config.NumWorkers
+				: !Cpus.empty() ? static_cast<uint32_t>(Cpus.size())
+				: GetNumCpus();
+
+			auto WorkerLoop = [this, &Config, &Cpus](uint32_t WorkerIndex)
+			{
+				CurrentPool = this;
+				CurrentWorker = WorkerIndex;
+				if (!Cpus.empty())
+				{
+					SetCurrentThreadAffinity(Config.bPinWorkers ? std::vector<uint32_t>{ Cpus[WorkerIndex % Cpus.size()] } : Cpus);
+				}
+				LocalMessages[WorkerIndex] = std::make_unique<LocalQueue>();
+
+				// Any deque can be stolen from, so all of them have to exist. The config is not accessed after.
+				const uint32_t Started = NumStarted.fetch_add(1) + 1;
+				if (Started == NumThreads)
+				{
+					NumStarted.notify_all();
+				}
+				for (uint32_t Seen = Started; Seen != NumThreads; Seen = NumStarted.load())
+				{
+					NumStarted.wait(Seen);
+				}
+
+				uint32_t IdleSpins = 0;
 				while (!bStopRequest.test(std::memory_order::relaxed))
 				{
-					auto GetFunc = [](AsyncTask& task) { return task.ForwardFunction(); };
-					std::optional<std::function<void()>> Msg = Messages.Pop(GetFunc);
-					if (Msg.has_value())
+					if (RunOne())
 					{
-						if (Msg.value())
-						{
-							Msg.value()();
-						}
+						IdleSpins = 0;
 					}
-					else
+					else if (++IdleSpins < kIdleSpins)
 					{
 						std::this_thread::yield();
 					}
+					else
+					{
+						Sleep();
+						IdleSpins = 0;
+					}
 				}
 			};
 
-			for (auto& Thread : Workers)
+			LocalMessages.resize(NumThreads);
+			Workers.reserve(NumThreads);
+			for (uint32_t Index = 0; Index < NumThreads; Index++)
+			{
+				Workers.emplace_back(WorkerLoop, Index);
+			}
+			for (uint32_t Seen = NumStarted.load(); Seen != NumThreads; Seen = NumStarted.load())
 			{
-				Thread = std::thread(WorkerLoop);
+				NumStarted.wait(Seen);
 			}
 		}
 
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
 		~ThreadPool()
 		{
 			bStopRequest.test_and_set();
+			WakeCounter.fetch_add(1);
+			WakeCounter.notify_all();
 			for (auto& Thread : Workers)
 			{
 				Thread.join();
 			}
 		}
 
+		// Call before the first Get, e.g. at the start of main.
+		static void ConfigureDefault(const ThreadPoolConfig& Config)
+		{
+			assert(!bDefaultCreated.load());
+			DefaultConfig() = Config;
+		}
+
+		// The default pool, a worker per CPU unless configured otherwise
 		static ThreadPool& Get()
 		{
-			static ThreadPool Pool;
+			static ThreadPool Pool = []()
+			{
+				bDefaultCreated.store(true);
+				return ThreadPool(DefaultConfig());
+			}();
 			return Pool;
 		}
+
+	private:
+		static inline std::atomic<bool> bDefaultCreated = false;
+
+		static ThreadPoolConfig& DefaultConfig()
+		{
+			static ThreadPoolConfig Config;
+			return Config;
+		}
 	};
 
 	template<typename Func> void AsyncTaskRequester::Start(Func&& fn)
+	{
+		Start(std::forward<Func>(fn), []() {});
+	}
+
+	template<typename Func, typename DoneFunc> void AsyncTaskRequester::Start(Func&& fn, DoneFunc&& on_done, ThreadPool* pool)
 	{
 		assert(GetState() == EState::NotStarted);
 		SetState(EState::Requested);
-		ThreadPool::Get().Push([this, Functor = std::forward<Func>(fn)]()
+		(pool ? *pool : ThreadPool::Get()).Push([this, Functor = std::forward<Func>(fn), OnDone = std::forward<DoneFunc>(on_done)]()
 		{
 			Functor();
 			SetState(EState::Done);
 			State.notify_one();
+			OnDone();
+			worker_released_.test_and_set();
+			worker_released_.notify_one();
 		}, this);
 	}
 
@@ -297,7 +579,11 @@ namespace MultiThread
 			return;
 		}
 
-		State.wait(EState::Executing);
+		const EState state = GetState();
+		if (state == EState::Executing || state == EState::Done)
+		{
+			worker_released_.wait(false);
+		}
 	}
 }
 
@@ -310,25 +596,35 @@ namespace Coroutine
 
 		Func Functor;
 		MultiThread::AsyncTaskRequester TaskSync;
+		MultiThread::ThreadPool* Pool = nullptr;	// The default pool when not set
 		[[no_unique_address]] ValueType Result;
 
 		Async(Func&& Fn) : Functor(std::forward<Func>(Fn)) {}
 
-		Async(Async&& Other)
+		Async(Func&& Fn, MultiThread::ThreadPool& InPool) : Functor(std::forward<Func>(Fn)), Pool(&InPool) {}
+
+		Async(Async&& Other) : Functor(std::move(Other.Functor)), Pool(Other.Pool)
 		{
 			assert(Other.TaskSync.GetState() == MultiThread::AsyncTaskRequester::EState::NotStarted);
-			Functor = std::move(Functor);
 		}
 
 		Async(const Async& Other) = delete;
 
-		void Start()
+		void Start(WakeBinding Wake = {})
 		{
-			TaskSync.Start([this]()
-				{
-					if constexpr (std::is_void_v<ReturnType>) { Functor(); }
-					else { Result = Functor(); }
-				});
+			auto Call = [this]()
+			{
+				if constexpr (std::is_void_v<ReturnType>) { Functor(); }
+				else { Result = Functor(); }
+			};
+			if (Wake)
+			{
+				TaskSync.Start(Call, [Wake]() { Wake.Notify(); }, Pool);
+			}
+			else
+			{
+				TaskSync.Start(Call, []() {}, Pool);
+			}
 		}
 		bool IsReady() const 
 		{ 
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include "Promise.h"
+#include "ReadyQueue.h"
+
+namespace Coroutine
+{
+	template <typename Return> class PromiseForAtomicSharedTask;
+	template <typename Return = void> class AtomicSharedTask;
+
+	// Awaiting frame, that is pushed to its ReadyQueue when the shared frame is done.
+	struct SharedTaskWaiter
+	{
+		WakeBinding Wake;
+		SharedTaskWaiter* Prev = nullptr;
+		SharedTaskWaiter* Next = nullptr;
+		bool bLinked = false;
+	};
+
+	// Which thread resumes the shared frame, and who waits for it.
+	// The lock guards only the waiter list and the transitions from Running, never a resume.
+	class SharedTaskSync
+	{
+	public:
+		enum class EClaim : uint32_t
+		{
+			Idle,		// Nobody resumes the frame
+			Running,	// Claimed by one awaiter, which resumes the frame
+			Done
+		};
+
+	private:
+		std::atomic<EClaim> Claim = EClaim::Idle;
+		std::atomic_flag Lock;
+		SharedTaskWaiter* Waiters = nullptr;
+
+		void AcquireLock()
+		{
+			while (Lock.test_and_set(std::memory_order_acquire))
+			{
+				Lock.wait(true, std::memory_order_relaxed);
+			}
+		}
+
+		void ReleaseLock()
+		{
+			Lock.clear(std::memory_order_release);
+			Lock.notify_one();
+		}
+
+		void Unlink(SharedTaskWaiter& Waiter)
+		{
+			(Waiter.Prev ? Waiter.Prev->Next : Waiters) = Waiter.Next;
+			if (Waiter.Next)
+			{
+				Waiter.Next->Prev = Waiter.Prev;
+			}
+			Waiter.Prev = Waiter.Next = nullptr;
+			Waiter.bLinked = false;
+		}
+
+		// Under the lock. Waiters are woken only once, they register again if needed.
+		void ReleaseClaim(EClaim Final)
+		{
+			Claim.store(Final, std::memory_order_release);
+			while (SharedTaskWaiter* Waiter = Waiters)
+			{
+				Waiter->Wake.Notify();
+				Unlink(*Waiter);
+			}
+		}
+
+	public:
+		EClaim GetClaim() const { return Claim.load(std::memory_order_acquire); }
+
+		bool TryClaim()
+		{
+			EClaim Expected = EClaim::Idle;
+			return Claim.compare_exchange_strong(Expected, EClaim::Running, std::memory_order_acq_rel);
+		}
+
+		// The claimer finished the frame, or gives up resuming it. All waiters are woken.
+		void Release(bool bDone)
+		{
+			AcquireLock();
+			ReleaseClaim(bDone ? EClaim::Done : EClaim::Idle);
+			ReleaseLock();
+		}
+
+		// Links the waiter, when the frame is Running. Returns the current claim.
+		EClaim Register(SharedTaskWaiter& Waiter)
+		{
+			assert(Waiter.Wake);
+			AcquireLock();
+			const EClaim Current = Claim.load(std::memory_order_acquire);
+			if (Current == EClaim::Running && !Waiter.bLinked)
+			{
+				Waiter.Next = Waiters;
+				if (Waiters)
+				{
+					Waiters->Prev = &Waiter;
+				}
+				Waiters = &Waiter;
+				Waiter.bLinked = true;
+			}
+			ReleaseLock();
+			return Current;
+		}
+
+		void Unregister(SharedTaskWaiter& Waiter)
+		{
+			AcquireLock();
+			if (Waiter.bLinked)
+			{
+				Unlink(Waiter);
+			}
+			ReleaseLock();
+		}
+	};
+
+	template <typename Return>
+	class PromiseForAtomicSharedTask : public PromiseReturn<Return, void, PromiseForAtomicSharedTask<Return>, AtomicSharedTask<Return>>
+	{
+		std::atomic<uint32_t> RefCount = 0;
+
+	public:
+		SharedTaskSync Sync;
+
+		void AddRef() { RefCount.fetch_add(1, std::memory_order_relaxed); }
+		bool RemoveRef()
+		{
+			const uint32_t Prev = RefCount.fetch_sub(1, std::memory_order_acq_rel);
+			assert(Prev);
+			return Prev == 1;
+		}
+
+		~PromiseForAtomicSharedTask()
+		{
+			assert(!RefCount.load(std::memory_order_relaxed));
+		}
+	};
+
+	// Shared task, that can be copied and awaited from many threads. The frame runs once, every awaiter reads the same result:
+	//	AtomicSharedTask<Mesh> Decode = DecodeMesh(Path);
+	//	const std::optional<Mesh>& Result = co_await Decode; // in any number of tasks
+	// The first awaiter claims the frame and resumes it from its own predicate. Other awaiters wait:
+	//	- a task bound to a ReadyQueue is pushed back when the frame is done (or when the claimer gives up),
+	//	- an unbound task polls one atomic.
+	// When the claiming task is destroyed, the frame stays suspended and the next awaiter continues it.
+	// The shared frame doesn't inherit wake binding or cancellation from the awaiters, its own awaits are polled by the claimer.
+	// The result lives in the shared frame, await a copy of the task (not a temporary) to keep the reference valid.
+	// A copy of the task can be awaited by one frame at a time.
+	template <typename Return>
+	class AtomicSharedTask : public VeryBaseAwaiter
+	{
+	public:
+		using promise_type = PromiseForAtomicSharedTask<Return>;
+		using HandleType = std::coroutine_handle<promise_type>;
+		using ReturnType = Return;
+		using EClaim = SharedTaskSync::EClaim;
+
+	private:
+		HandleType Handle;
+
+		// State of the current co_await
+		PromiseCore* Awaiting = nullptr;
+		SharedTaskWaiter Waiter;
+		bool bClaimed = false;
+
+		promise_type* GetPromise() const
+		{
+			return Handle ? &Handle.promise() : nullptr;
+		}
+
+		void AddRef()
+		{
+			if (promise_type* P = GetPromise())
+			{
+				P->AddRef();
+			}
+		}
+		void RemoveRef()
+		{
+			promise_type* P = GetPromise();
+			if (P && P->RemoveRef())
+			{
+				Handle.destroy();
+			}
+			Handle = nullptr;
+		}
+
+		// Resumes the claimed frame. Returns true when it's done.
+		bool ResumeClaimed()
+		{
+			promise_type& Promise = Handle.promise();
+			Promise.Resume();
+			const EStatus Status = Promise.Status();
+			assert(Status != EStatus::Resuming);
+			if (Status == EStatus::Suspended)
+			{
+				return false;
+			}
+			bClaimed = false;
+			Promise.Sync.Release(true);
+			return true;
+		}
+
+		// Predicate of the awaiting frame. Returns true when the result is ready.
+		bool Update()
+		{
+			promise_type& Promise = Handle.promise();
+			if (bClaimed)
+			{
+				return ResumeClaimed();
+			}
+			if (Promise.Sync.GetClaim() == EClaim::Done)
+			{
+				return true;
+			}
+			if (Promise.Sync.TryClaim())
+			{
+				bClaimed = true;
+				Promise.Sync.Unregister(Waiter);
+				return ResumeClaimed();
+			}
+			if (!Waiter.Wake)
+			{
+				return false;
+			}
+			const EClaim Claim = Promise.Sync.Register(Waiter);
+			if (Claim == EClaim::Running)
+			{
+				Awaiting->WaitForEvent();
+			}
+			return Claim == EClaim::Done;
+		}
+
+		void ResetAwait()
+		{
+			if (!Awaiting)
+			{
+				return;
+			}
+			promise_type& Promise = Handle.promise();
+			if (bClaimed)
+			{
+				bClaimed = false;
+				Promise.Sync.Release(false);
+			}
+			Promise.Sync.Unregister(Waiter);
+			Waiter.Wake = {};
+			Awaiting = nullptr;
+		}
+
+		friend PromiseBase<Return, void, promise_type, AtomicSharedTask>;
+		AtomicSharedTask(HandleType InHandle) : Handle(InHandle) { AddRef(); }
+
+	public:
+		AtomicSharedTask() = default;
+		AtomicSharedTask(AtomicSharedTask&& Other) : Handle(std::exchange(Other.Handle, nullptr))
+		{
+			assert(!Other.Awaiting);
+		}
+		AtomicSharedTask& operator=(AtomicSharedTask&& Other)
+		{
+			assert(!Other.Awaiting);
+			Reset();
+			Handle = std::exchange(Other.Handle, nullptr);
+			return *this;
+		}
+		AtomicSharedTask(const AtomicSharedTask& Other) : Handle(Other.Handle)
+		{
+			AddRef();
+		}
+		AtomicSharedTask& operator=(const AtomicSharedTask& Other)
+		{
+			if (this != &Other)
+			{
+				Reset();
+				Handle = Other.Handle;
+				AddRef();
+			}
+			return *this;
+		}
+		~AtomicSharedTask()
+		{
+			Reset();
+		}
+
+		void Reset()
+		{
+			ResetAwait();
+			RemoveRef();
+		}
+
+		// Thread safe
+		bool IsDone() const
+		{
+			const promise_type* Promise = GetPromise();
+			return !Promise || Promise->Sync.GetClaim() == EClaim::Done;
+		}
+
+		// Thread safe, valid once the task is done. The same value for all copies.
+		template <typename U = ReturnType, typename std::enable_if_t<!std::is_void<U>::value>* = nullptr>
+		const std::optional<ReturnType>& Get() const
+		{
+			static const std::optional<ReturnType> Empty;
+			return IsDone() && Handle ? Handle.promise().PeekResult() : Empty;
+		}
+
+		bool await_ready() const noexcept { return IsDone(); }
+
+		template <typename PromiseType>
+		bool await_suspend(std::coroutine_handle<PromiseType> InHandle) noexcept
+		{
+			assert(InHandle && !Awaiting);
+			Awaiting = &InHandle.promise();
+			Waiter.Wake = Awaiting->GetWake();
+			if (Update())
+			{
+				ResetAwait();
+				return false;
+			}
+			Awaiting->SetFunc([this]() -> bool { return Update(); });
+			return true;
+		}
+
+		decltype(auto) await_resume()
+		{
+			ResetAwait();
+			if constexpr (!std::is_void_v<ReturnType>)
+			{
+				return Get();
+			}
+		}
+	};
+}
@@ -33,6 +33,30 @@ namespace Coroutine
 			}
 		}
 
+		// Untyped promise, used to link the task into a continuation chain.
+		PromiseCore* GetCore() const
+		{
+			return GetPromise();
+		}
+
+		// The task (and everything it awaits) is Done without result, when the token is cancelled.
+		void SetCancellation(CancellationToken Token)
+		{
+			if (PromiseType* Promise = GetPromise())
+			{
+				Promise->SetCancellation(Token);
+			}
+		}
+
+		// Name in the trace (COROUTINE_TRACE), instead of the coroutine function. The string has to outlive the trace.
+		void SetTraceName(const char* Name)
+		{
+			if (PromiseType* Promise = GetPromise())
+			{
+				Promise->SetTraceName(Name);
+			}
+		}
+
 		EStatus Status() const
 		{
 			const PromiseType* Promise = GetPromise();
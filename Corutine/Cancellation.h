@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Coroutine
+{
+	// Observes a CancellationSource. Checking it is a single relaxed load.
+	class CancellationToken
+	{
+		const std::atomic<bool>* Flag = nullptr;
+
+		friend class CancellationSource;
+		explicit CancellationToken(const std::atomic<bool>* InFlag) : Flag(InFlag) {}
+
+	public:
+		CancellationToken() = default;
+
+		bool IsCancelled() const
+		{
+			return Flag && Flag->load(std::memory_order_relaxed);
+		}
+
+		explicit operator bool() const { return !!Flag; }
+	};
+
+	// Cancels every task holding its token, and everything they await.
+	// A cancelled task is Done without a result. Cancel is thread safe.
+	// The source has to outlive the tasks holding its token.
+	// Owners parking tasks, that wait for an event, watch NumCancels: when it changes, the cancelled tasks have to be resumed.
+	class CancellationSource
+	{
+		std::atomic<bool> bCancelled = false;
+
+		static inline std::atomic<uint32_t> CancelCounter = 0;
+
+		CancellationSource(const CancellationSource&) = delete;
+		CancellationSource& operator=(const CancellationSource&) = delete;
+
+	public:
+		CancellationSource() = default;
+
+		void Cancel()
+		{
+			bCancelled.store(true, std::memory_order_relaxed);
+			// Release: the flag is seen by whoever sees the new counter
+			CancelCounter.fetch_add(1, std::memory_order_release);
+		}
+		bool IsCancelled() const { return bCancelled.load(std::memory_order_relaxed); }
+		CancellationToken GetToken() const { return CancellationToken(&bCancelled); }
+
+		// Number of Cancel calls of all sources, wraps around
+		static uint32_t NumCancels() { return CancelCounter.load(std::memory_order_acquire); }
+	};
+}
@@ -75,6 +75,11 @@ namespace std
 			return !(_Left == _Right);
 		}
 
+		inline coroutine_handle<> noop_coroutine() noexcept
+		{
+			return coroutine_handle<>::from_address(__builtin_coro_noop());
+		}
+
 		struct suspend_always 
 		{
 			bool await_ready() noexcept { return false; }
@@ -95,4 +100,5 @@ namespace std
 	using coroutine_handle = experimental::coroutine_handle<_Promise>;
 	using suspend_never = experimental::suspend_never;
 	using suspend_always = experimental::suspend_always;
+	using experimental::noop_coroutine;
 };
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace Coroutine
+{
+	// Opt-in switch for pooled coroutine frames. Specialize for a task type to allocate its frames from FramePool:
+	//	template <> struct PooledFrames<UniqueTask<int>> : std::true_type {};
+	// The specialization has to be visible before the first coroutine returning that task type.
+	template <typename TaskType> struct PooledFrames : std::false_type {};
+
+	// Per-thread free lists of coroutine frames, grouped in size classes.
+	// A frame may be released on other thread than it was allocated on, it's simply cached by the releasing thread.
+	// Frames bigger than the largest size class go directly to the global allocator.
+	class FramePool
+	{
+	public:
+		static constexpr std::size_t kGranularity = 64;
+		static constexpr std::size_t kNumSizeClasses = 16;
+		static constexpr std::size_t kMaxCachedPerClass = 1024;
+
+		struct Stats
+		{
+			uint64_t Hits = 0;		// Allocation served from the free list
+			uint64_t Misses = 0;	// Allocation served by the global allocator
+		};
+
+	private:
+		struct FreeNode
+		{
+			FreeNode* Next = nullptr;
+		};
+
+		struct SizeClass
+		{
+			FreeNode* Head = nullptr;
+			std::size_t Num = 0;
+		};
+
+		std::array<SizeClass, kNumSizeClasses> Classes;
+		Stats Counters;
+
+		// Trivially destructible, so it remains valid after the pool of this thread was destroyed.
+		static inline thread_local bool bDestroyed = false;
+
+		FramePool() = default;
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+
+		~FramePool()
+		{
+			ReleaseAll();
+			bDestroyed = true;
+		}
+
+		void ReleaseAll() noexcept
+		{
+			for (SizeClass& Class : Classes)
+			{
+				while (FreeNode* Node = Class.Head)
+				{
+					Class.Head = Node->Next;
+					Node->~FreeNode();
+					::operator delete(Node);
+				}
+				Class.Num = 0;
+			}
+		}
+
+		static FramePool& Local()
+		{
+			static thread_local FramePool Pool;
+			return Pool;
+		}
+
+		static constexpr std::size_t ClassIndex(std::size_t Size)
+		{
+			return Size ? (Size - 1) / kGranularity : 0;
+		}
+
+		static constexpr bool IsPoolable(std::size_t Size)
+		{
+			return ClassIndex(Size) < kNumSizeClasses;
+		}
+
+	public:
+		static void* Allocate(std::size_t Size)
+		{
+			if (!IsPoolable(Size) || bDestroyed)
+			{
+				return ::operator new(Size);
+			}
+
+			FramePool& Pool = Local();
+			const std::size_t Index = ClassIndex(Size);
+			SizeClass& Class = Pool.Classes[Index];
+			if (FreeNode* Node = Class.Head)
+			{
+				Class.Head = Node->Next;
+				Class.Num--;
+				Pool.Counters.Hits++;
+				Node->~FreeNode();
+				return Node;
+			}
+			Pool.Counters.Misses++;
+			return ::operator new((Index + 1) * kGranularity);
+		}
+
+		static void Free(void* Ptr, std::size_t Size) noexcept
+		{
+			if (!Ptr)
+			{
+				return;
+			}
+
+			if (!IsPoolable(Size) || bDestroyed)
+			{
+				::operator delete(Ptr);
+				return;
+			}
+
+			SizeClass& Class = Local().Classes[ClassIndex(Size)];
+			if (Class.Num >= kMaxCachedPerClass)
+			{
+				::operator delete(Ptr);
+				return;
+			}
+			Class.Head = ::new(Ptr) FreeNode{ Class.Head };
+			Class.Num++;
+		}
+
+		// Returns all cached frames of the calling thread to the global allocator.
+		static void Trim() noexcept
+		{
+			if (!bDestroyed)
+			{
+				Local().ReleaseAll();
+			}
+		}
+
+		// Counters of the calling thread.
+		static Stats GetStats()
+		{
+			return bDestroyed ? Stats{} : Local().Counters;
+		}
+
+		static void ResetStats()
+		{
+			if (!bDestroyed)
+			{
+				Local().Counters = Stats{};
+			}
+		}
+	};
+}
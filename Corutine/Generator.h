@@ -0,0 +1,118 @@
+#pragma once
+
+#include <iterator>
+#include <ranges>
+
+#include "UniqueTask.h"
+
+namespace Coroutine
+{
+	template <typename Yield, typename Return = void> class Generator;
+
+	// Keeps only a pointer to the yielded object. The object lives in the coroutine frame until the next resume.
+	template <typename Return, typename Yield>
+	class PromiseForGenerator : public PromiseReturn<Return, Yield, PromiseForGenerator<Return, Yield>, Generator<Yield, Return>>
+	{
+		const Yield* ValueYield = nullptr;
+
+	public:
+		// A temporary operand of co_yield lives until the coroutine is resumed.
+		std::suspend_always yield_value(const Yield& InValue)
+		{
+			ValueYield = &InValue;
+			return {};
+		}
+
+		const Yield* PeekYield() const { return ValueYield; }
+		void ClearYield() { ValueYield = nullptr; }
+
+		// Copies the value, compatible with other tasks
+		std::optional<Yield> ConsumeYield()
+		{
+			auto Guard = MakeFnGuard([&]() { ValueYield = nullptr; });
+			return ValueYield ? std::optional<Yield>(*ValueYield) : std::optional<Yield>{};
+		}
+	};
+
+	// Task, which yielded values are read in place, without copy:
+	//	for (const Event& Evt : ReadEvents()) {...}
+	//	for (int Value : Fibonacci() | std::views::take(10)) {...}
+	// Iterating resumes the coroutine until the next co_yield. Awaits inside are resumed in a busy loop.
+	template <typename Yield, typename Return>
+	class Generator : public UniqueTask<Return, Yield, PromiseForGenerator<Return, Yield>>, public std::ranges::view_base
+	{
+		using PromiseType = PromiseForGenerator<Return, Yield>;
+		using Super = UniqueTask<Return, Yield, PromiseType>;
+		using HandleType = std::coroutine_handle<PromiseType>;
+		using Super::GetPromise;
+
+		friend PromiseBase<Return, Yield, PromiseType, Generator>;
+		Generator(HandleType InHandle) : Super(InHandle) {}
+
+	public:
+		class Iterator
+		{
+			Generator* Owner = nullptr;
+
+		public:
+			using iterator_concept = std::input_iterator_tag;
+			using value_type = Yield;
+			using difference_type = std::ptrdiff_t;
+			using reference = const Yield&;
+
+			Iterator() = default;
+			explicit Iterator(Generator& InOwner) : Owner(&InOwner) {}
+
+			reference operator*() const { return *Owner->Peek(); }
+			const Yield* operator->() const { return Owner->Peek(); }
+			Iterator& operator++()
+			{
+				Owner->Advance();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+
+			friend bool operator==(const Iterator& It, std::default_sentinel_t) { return !It.Owner || !It.Owner->Peek(); }
+		};
+
+		Generator() = default;
+		Generator(Generator&&) = default;
+		Generator& operator=(Generator&&) = default;
+
+		// Value of the last co_yield, nullptr when the generator is not suspended on co_yield.
+		const Yield* Peek() const
+		{
+			const PromiseType* Promise = GetPromise();
+			return Promise ? Promise->PeekYield() : nullptr;
+		}
+
+		// Resumes until the next co_yield, or until the generator is done.
+		// Returns the yielded value.
+		const Yield* Advance()
+		{
+			PromiseType* Promise = GetPromise();
+			if (!Promise)
+			{
+				return nullptr;
+			}
+			Promise->ClearYield();
+			while (Promise->Status() == EStatus::Suspended)
+			{
+				Promise->Resume();
+				if (Promise->PeekYield())
+				{
+					break;
+				}
+			}
+			return Promise->PeekYield();
+		}
+
+		// Starts the iteration, it can be called once.
+		Iterator begin()
+		{
+			Advance();
+			return Iterator(*this);
+		}
+		std::default_sentinel_t end() const { return {}; }
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <assert.h>
+
+namespace Coroutine
+{
+	template <typename Signature, std::size_t kCapacity> class InlineFunction;
+
+	// Type-erased callable stored in place. Never allocates, a callable that doesn't fit is a compile error.
+	// The callable is constructed directly in the final storage. It can be moved to other InlineFunction, when it's move constructible.
+	template <typename Ret, typename... Args, std::size_t kCapacity>
+	class InlineFunction<Ret(Args...), kCapacity>
+	{
+		using InvokeType = Ret(*)(void*, Args...);
+		using DestroyType = void(*)(void*);
+		using RelocateType = void(*)(void* To, void* From); // Moves the callable and destroys the source
+
+		alignas(std::max_align_t) std::byte Storage[kCapacity];
+		InvokeType Invoke = nullptr;
+		DestroyType Destroy = nullptr; // Not set for trivially destructible callables
+		RelocateType Relocate = nullptr;
+
+		InlineFunction(const InlineFunction&) = delete;
+		InlineFunction& operator=(const InlineFunction&) = delete;
+		InlineFunction& operator=(InlineFunction&&) = delete;
+
+	public:
+		InlineFunction() = default;
+
+		InlineFunction(InlineFunction&& Other)
+			: Invoke(Other.Invoke), Destroy(Other.Destroy), Relocate(Other.Relocate)
+		{
+			if (Invoke)
+			{
+				assert(Relocate);
+				Relocate(Storage, Other.Storage);
+				Other.Invoke = nullptr;
+				Other.Destroy = nullptr;
+				Other.Relocate = nullptr;
+			}
+		}
+
+		~InlineFunction()
+		{
+			Reset();
+		}
+
+		template <typename Fn>
+		void Emplace(Fn&& InFunc)
+		{
+			using FuncType = std::decay_t<Fn>;
+			static_assert(sizeof(FuncType) <= kCapacity, "The callable (its captures) doesn't fit into the inline storage.");
+			static_assert(alignof(FuncType) <= alignof(std::max_align_t), "The callable is overaligned.");
+			static_assert(std::is_invocable_r_v<Ret, FuncType&, Args...>, "Wrong signature of the callable.");
+
+			Reset();
+			::new(static_cast<void*>(Storage)) FuncType(std::forward<Fn>(InFunc));
+			Invoke = [](void* Ptr, Args... InArgs) -> Ret
+			{
+				return (*std::launder(static_cast<FuncType*>(Ptr)))(std::forward<Args>(InArgs)...);
+			};
+			if constexpr (!std::is_trivially_destructible_v<FuncType>)
+			{
+				Destroy = [](void* Ptr) { std::launder(static_cast<FuncType*>(Ptr))->~FuncType(); };
+			}
+			if constexpr (std::is_move_constructible_v<FuncType>)
+			{
+				Relocate = [](void* To, void* From)
+				{
+					FuncType* Source = std::launder(static_cast<FuncType*>(From));
+					::new(To) FuncType(std::move(*Source));
+					Source->~FuncType();
+				};
+			}
+		}
+
+		void Reset()
+		{
+			if (Destroy)
+			{
+				Destroy(Storage);
+				Destroy = nullptr;
+			}
+			Invoke = nullptr;
+			Relocate = nullptr;
+		}
+
+		Ret operator()(Args... InArgs)
+		{
+			assert(Invoke);
+			return Invoke(Storage, std::forward<Args>(InArgs)...);
+		}
+
+		explicit operator bool() const { return !!Invoke; }
+	};
+}
@@ -2,210 +2,448 @@
 
 #include<atomic>
 #include<optional>
+#include<algorithm>
+#include<memory>
+#include<bit>
+#include<thread>
+#include<mutex>
+#include<chrono>
+#include<condition_variable>
+#include<cstdio>
+#include<cstdlib>
 #include<assert.h>
 
-template<typename T, uint32_t kSize> 
+#include "MPMCQueue.h"
+#include "Promise.h"
+
+// Queue of blocks, each holds kSize elements. Up to kMaxNum elements can be queued.
+// Elements have consecutive positions. The block of a position is found in a ring of block pointers (directory),
+// so any element is reached in constant time, however many elements are queued.
+// A block is recycled by the consumer reading its last element. Free blocks are kept up to a limit, the idle ones can be trimmed.
+// Up to 65535 elements, the positions and the count share a single 8-byte word. Above, the queue is wide:
+// producers and consumers have separate 64-bit positions (tickets).
+// Exceeding kMaxNum in an unbounded queue aborts, in every build: the narrow count would wrap around, wide producers would wait forever.
+// Bounded queue never holds more than kMaxNum elements, its memory is fixed. Producers use TryEnqueue,
+// wait in Enqueue (atomic wait, notified by consumers), or suspend the task in co_await EnqueueAsync:
+//	LockFreeQueue<Job, 64, 4096, true> Jobs;
+// Padded layout (PaddedLockFreeQueue) gives every slot, with its written flag, own cache line. Hot fields of producers
+// and consumers are on separate cache lines too. It uses more memory, but threads writing neighbouring slots don't contend.
+template<typename T, uint32_t kSize, uint32_t kMaxNum = UINT16_MAX, bool kBounded = false, bool kPadded = false>
 class LockFreeQueue
 {
+	static_assert(kSize >= 2 && !(kSize & (kSize - 1)), "Block size has to be a power of 2");
+	static_assert(kMaxNum >= kSize, "The queue has to hold at least one block");
+
 	LockFreeQueue(const LockFreeQueue&) = delete;
 	LockFreeQueue& operator=(const LockFreeQueue&) = delete;
 	LockFreeQueue(const LockFreeQueue&&) = delete;
 	LockFreeQueue& operator=(const LockFreeQueue&&) = delete;
 
-	struct Block
+	static constexpr bool kWide = kMaxNum > UINT16_MAX;
+
+	static constexpr std::size_t kCacheLine = 64;
+	// Alignment of a field, that should not share the cache line in the padded layout
+	template<typename U>
+	static constexpr std::size_t kHotAlign = kPadded ? std::max(kCacheLine, alignof(U)) : alignof(U);
+
+	// Elements are passed through the written flags and the directory. Positions need the total order only for wake-ups:
+	// a producer reserves, then reads the flag of waiting consumers (PopFor); a consumer sets it, then reads the count.
+	// Similarly for producers waiting on a bounded queue.
+	static constexpr std::memory_order kReserveOrder = std::memory_order_seq_cst;
+	static constexpr std::memory_order kClaimOrder = kBounded ? std::memory_order_seq_cst : std::memory_order_relaxed;
+
+	[[noreturn]] static void CapacityExceeded()
+	{
+		std::fprintf(stderr, "LockFreeQueue: more than %u elements queued\n", kMaxNum);
+		std::abort();
+	}
+
+	// Positions and the count in a single word
+	class NarrowPositions
+	{
+		struct alignas(8) State
+		{
+			uint32_t head = 0;	// Position of the oldest element
+			uint16_t count = 0;
+			uint16_t unused = 0;
+		};
+
+		std::atomic<State> state_;
+
+	public:
+		using Position = uint32_t;
+
+		Position Reserve(const uint32_t num)
+		{
+			State prev_state = state_.load(std::memory_order_relaxed);
+			State next_state;
+			do
+			{
+				if (prev_state.count + num > kMaxNum) [[unlikely]]
+					CapacityExceeded();
+				next_state = prev_state;
+				next_state.count = prev_state.count + num;
+			} while (!state_.compare_exchange_weak(prev_state, next_state, kReserveOrder));
+			return prev_state.head + prev_state.count;
+		}
+
+		std::optional<Position> TryReserve(const uint32_t num)
+		{
+			// A full queue is seen without a CAS. The load has to be in the total order with the producers_waiting_ flag.
+			State prev_state = state_.load(kReserveOrder);
+			State next_state;
+			do
+			{
+				if (prev_state.count + num > kMaxNum)
+					return {};
+				next_state = prev_state;
+				next_state.count = prev_state.count + num;
+			} while (!state_.compare_exchange_weak(prev_state, next_state, kReserveOrder));
+			return prev_state.head + prev_state.count;
+		}
+
+		std::optional<Position> TryClaim(const uint32_t max_num, uint32_t& out_num)
+		{
+			State new_state;
+			State prev_state = state_.load(std::memory_order_relaxed);
+			do
+			{
+				if (!prev_state.count)
+					return {};
+				out_num = std::min<uint32_t>(prev_state.count, max_num);
+				new_state = prev_state;
+				new_state.head = prev_state.head + out_num;
+				new_state.count = prev_state.count - out_num;
+			} while (!state_.compare_exchange_weak(prev_state, new_state, kClaimOrder));
+			return prev_state.head;
+		}
+
+		uint32_t Num(const std::memory_order order = std::memory_order_relaxed) const { return state_.load(order).count; }
+	};
+
+	// Producers take tickets without a CAS loop. Consumers claim only tickets, that were already taken.
+	class WidePositions
+	{
+		alignas(64) std::atomic<uint64_t> tail_ = 0;	// Next reserved position
+		alignas(64) std::atomic<uint64_t> head_ = 0;	// Oldest not claimed position
+
+	public:
+		using Position = uint64_t;
+
+		Position Reserve(const uint32_t num)
+		{
+			const Position first_position = tail_.fetch_add(num, kReserveOrder);
+			// Consumers may have claimed the positions of later producers already. A stale head would abort for nothing.
+			const Position head = head_.load(kReserveOrder);
+			if (head <= first_position && first_position + num - head > kMaxNum) [[unlikely]]
+				CapacityExceeded();
+			return first_position;
+		}
+
+		// Tickets are taken only when they fit.
+		std::optional<Position> TryReserve(const uint32_t num)
+		{
+			Position tail = tail_.load(std::memory_order_relaxed);
+			do
+			{
+				const Position head = head_.load(kReserveOrder);
+				if (tail > head && tail - head + num > kMaxNum)
+					return {};
+			} while (!tail_.compare_exchange_weak(tail, tail + num, kReserveOrder));
+			return tail;
+		}
+
+		std::optional<Position> TryClaim(const uint32_t max_num, uint32_t& out_num)
+		{
+			Position head = head_.load(std::memory_order_relaxed);
+			do
+			{
+				// The tail never decreases, so the positions below the loaded one stay reserved
+				const Position tail = tail_.load(kClaimOrder);
+				if (head >= tail)
+					return {};
+				out_num = static_cast<uint32_t>(std::min<Position>(tail - head, max_num));
+			} while (!head_.compare_exchange_weak(head, head + out_num, kClaimOrder));
+			return head;
+		}
+
+		uint32_t Num(const std::memory_order order = std::memory_order_relaxed) const
+		{
+			const Position head = head_.load(order);
+			const Position tail = tail_.load(order);
+			return tail > head ? static_cast<uint32_t>(tail - head) : 0;
+		}
+	};
+
+	using Positions = std::conditional_t<kWide, WidePositions, NarrowPositions>;
+	using Position = typename Positions::Position;
+
+	using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+	// Payloads, then the written flags
+	struct DenseBlock
 	{
-		std::aligned_storage_t<sizeof(T), alignof(T)> data[kSize];
+		Storage data[kSize];
 		std::atomic_flag written[kSize];
-		Block* next = nullptr;
-		std::atomic<uint32_t> written_num = 0;
+		Position index = 0;		// Position / kSize of the first element, while the block is in the directory
+		std::atomic<uint32_t> read_num = 0;
+
+		Storage& Data(const uint32_t index_in_block) { return data[index_in_block]; }
+		std::atomic_flag& Written(const uint32_t index_in_block) { return written[index_in_block]; }
 	};
 
-	struct alignas(8) State
+	// The flag is written together with its payload. The counter of consumers doesn't share the line with any slot.
+	struct PaddedBlock
 	{
-		Block* block = nullptr;
-		uint16_t first = 0;
-		uint16_t count = 0;
-#ifndef NDEBUG
-		uint16_t num_blocks = 0;
-#endif
+		struct alignas(kHotAlign<Storage>) Slot
+		{
+			Storage data;
+			std::atomic_flag written;
+		};
+
+		Slot slots[kSize];
+		alignas(kCacheLine) Position index = 0;
+		std::atomic<uint32_t> read_num = 0;
+
+		Storage& Data(const uint32_t index_in_block) { return slots[index_in_block].data; }
+		std::atomic_flag& Written(const uint32_t index_in_block) { return slots[index_in_block].written; }
 	};
 
-	std::atomic<State> state_;
-	std::atomic<Block*> free_list_head_ = nullptr;
-	std::atomic_flag releasing_;
+	using Block = std::conditional_t<kPadded, PaddedBlock, DenseBlock>;
+
+	// A block is accessed only through the entry with its index, so a free block is never read and can be deleted any time.
+	struct Entry
+	{
+		std::atomic<Block*> block = nullptr;
+		std::atomic<Position> index = ~Position(0);
+	};
+
+	// Holds all the blocks with queued elements, plus the ones still being read or written.
+	static constexpr uint32_t kDirectorySize = std::bit_ceil(kMaxNum / kSize + 3);
+
+	// Blocks are exchanged through a ring with per-slot sequence numbers, there is no ABA.
+	using FreeBlocks = MPMCQueue<Block*, kDirectorySize>;
+
+	// Written by every producer and consumer
+	alignas(kHotAlign<Positions>) Positions positions_;
+	// Read by every operation, written once per block
+	alignas(kHotAlign<Entry*>) std::unique_ptr<Entry[]> directory_ = std::make_unique<Entry[]>(kDirectorySize);
+	std::unique_ptr<FreeBlocks> free_blocks_ = std::make_unique<FreeBlocks>();
+	std::atomic<uint32_t> allocated_blocks_ = 0;
+	std::atomic<uint32_t> max_free_blocks_ = kDirectorySize;
+	std::atomic<uint32_t> idle_free_blocks_ = 0;	// The fewest free blocks since the last trim
+	// Bounded only. Read by every consumer.
+	alignas(kHotAlign<std::atomic<bool>>) std::atomic<bool> producers_waiting_ = false;	// Set by producers before they wait, cleared by the notifying consumer
+	std::atomic<uint32_t> freed_space_ = 0;			// Producers wait for a change
+	// Consumers sleeping in PopFor. Read by every producer.
+	alignas(kHotAlign<std::atomic<bool>>) std::atomic<bool> consumers_waiting_ = false;
+	std::mutex consumers_mutex_;
+	std::condition_variable consumers_wake_;
 
 	void MoveToFreeList(Block* block)
 	{
-		//no need to check if all data were already read. It's single consumer queue
 		assert(block);
-		assert(!block->written_num);
-		assert([&]() -> bool 
+		assert(!block->read_num);
+		assert([&]() -> bool
 		{
-			for (auto& written : block->written)
+			for (uint32_t i = 0; i < kSize; i++)
 			{
-				if (written.test()) 
+				if (block->Written(i).test())
 					return false;
 			}
-			return true; 
+			return true;
 		}());
-		assert(!block->next);
-		block->next = free_list_head_.load(std::memory_order_relaxed);
-		while (!free_list_head_.compare_exchange_weak(block->next, block));
+		if (free_blocks_->Num() >= max_free_blocks_.load(std::memory_order_relaxed) || !free_blocks_->TryEnqueue(block))
+		{
+			DeleteBlock(block);
+		}
 	}
 
-	Block* GetBlockFromFreeList()
+	Block* GetOrAllocateFreeBlock()
 	{
-		//no need to check if all data were already read. It's single consumer queue
-		Block* local_head = free_list_head_.load(std::memory_order_relaxed);
-		do
+		std::optional<Block*> block = free_blocks_->Pop();
+		const uint32_t num_free = free_blocks_->Num();
+		for (uint32_t idle = idle_free_blocks_.load(std::memory_order_relaxed); num_free < idle;)
 		{
-			if (!local_head)
-				return nullptr;
-		} 
-		while (!free_list_head_.compare_exchange_weak(local_head, local_head->next));
-		local_head->next = nullptr;
-		assert(!local_head->written_num);
-		assert([&]() -> bool
+			if (idle_free_blocks_.compare_exchange_weak(idle, num_free, std::memory_order_relaxed))
+				break;
+		}
+		return block ? *block : AllocateBlock();
+	}
+
+	Block* AllocateBlock()
+	{
+		allocated_blocks_.fetch_add(1, std::memory_order_relaxed);
+		return new Block();
+	}
+
+	void DeleteBlock(Block* block)
+	{
+		allocated_blocks_.fetch_sub(1, std::memory_order_relaxed);
+		delete block;
+	}
+
+	Entry& GetEntry(const Position block_index)
+	{
+		return directory_[block_index & (kDirectorySize - 1)];
+	}
+
+	// Called by the producer, that reserved the first position of the block.
+	void InstallBlock(const Position block_index)
+	{
+		Block* block = GetOrAllocateFreeBlock();
+		assert(block);
+		block->index = block_index;
+		Entry& entry = GetEntry(block_index);
+		// The previous block in this entry can still have the last elements being read
+		for (Block* expected = nullptr; !entry.block.compare_exchange_weak(expected, block, std::memory_order_relaxed); expected = nullptr)
 		{
-			for (auto& written : local_head->written)
-			{
-				if (written.test()) 
-					return false;
-			}
-			return true;
-		}());
-		return local_head;
+			std::this_thread::yield();
+		}
+		entry.index.store(block_index, std::memory_order_release);
 	}
 
-	Block* GetOrAllocateFreeBlock()
+	// The block may be installed by other producer just now. It stays in the entry, until the caller reads its element.
+	Block* WaitForBlock(const Position block_index)
 	{
-		Block* block = GetBlockFromFreeList();
-		return block ? block : new Block();
+		Entry& entry = GetEntry(block_index);
+		while (entry.index.load(std::memory_order_acquire) != block_index)
+		{
+			std::this_thread::yield();
+		}
+		return entry.block.load(std::memory_order_relaxed);
 	}
 
-	State PrepareSpaceForNewElement()
+	// Blocks starting in the reserved range
+	void InstallBlocks(const Position first_position, const uint32_t num)
 	{
-		State next_state;
-		Block* new_block = nullptr;
-		State prev_state = state_.load(std::memory_order_relaxed);
-		auto manage_block = [&]() -> Block*
+		for (Position block_start = (first_position + kSize - 1) & ~Position(kSize - 1); block_start - first_position < num; block_start += kSize)
 		{
-			assert(prev_state.count > 0 || !prev_state.block || !prev_state.block->next);
+			InstallBlock(block_start / kSize);
+		}
+	}
 
-			const bool no_room_in_prev = !prev_state.first && !!prev_state.count;
-			if (no_room_in_prev || !prev_state.block)
-			{
-				if (!new_block)
-				{
-					new_block = GetOrAllocateFreeBlock();
-					assert(new_block);
-				}
-				new_block->next = prev_state.block;
-				return new_block;
-			}
+	// Reserves positions for num elements with a single state update. Returns the first one.
+	// A bounded queue waits until they fit.
+	Position Reserve(const uint32_t num)
+	{
+		assert(num);
+		Position first_position;
+		if constexpr (kBounded)
+		{
+			assert(num <= kMaxNum);
+			first_position = WaitAndReserve(num);
+		}
+		else
+		{
+			first_position = positions_.Reserve(num);
+		}
+		InstallBlocks(first_position, num);
+		return first_position;
+	}
 
-			//We don't need a new block, but we already allocated one.
-			if (new_block)
-			{	
-				new_block->next = nullptr;
-				MoveToFreeList(new_block);
-				new_block = nullptr;
-			}
-			return prev_state.block;
-		};
-		do
+	std::optional<Position> TryReserve(const uint32_t num)
+	{
+		static_assert(kBounded, "Only a bounded queue can be full");
+		const std::optional<Position> first_position = positions_.TryReserve(num);
+		if (first_position)
 		{
-			next_state.block = manage_block();
-			next_state.first = (prev_state.first - 1) % kSize;
-			next_state.count = prev_state.count + 1;
-#ifndef NDEBUG
-			next_state.num_blocks = prev_state.num_blocks + (new_block ? 1 : 0);
-#endif	
-		} while (!state_.compare_exchange_weak(prev_state, next_state));
-		return next_state;
+			InstallBlocks(*first_position, num);
+		}
+		return first_position;
 	}
 
-	std::optional<State> TryDecrement()
+	// The first consumer, that frees space after a producer started waiting, notifies (the flag is seen after its own claim).
+	Position WaitAndReserve(const uint32_t num)
 	{
-		State new_state;
-		State prev_state = state_.load(std::memory_order_relaxed);
-		do
+		// Consumers usually free some space soon, a system call is made only after a few tries
+		constexpr uint32_t kYields = 8;
+		for (uint32_t tries = 0; true; tries++)
 		{
-			if (!prev_state.count)
-				return {};
-			new_state = prev_state;
-			new_state.count = prev_state.count - 1;
-		} while (!state_.compare_exchange_weak(prev_state, new_state));
-		assert(new_state.first < kSize);
-		return new_state;
+			if (const std::optional<Position> first_position = positions_.TryReserve(num))
+				return *first_position;
+			if (tries < kYields)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			const uint32_t freed_space = freed_space_.load();
+			producers_waiting_.store(true);
+			if (const std::optional<Position> first_position = positions_.TryReserve(num))
+				return *first_position;
+			freed_space_.wait(freed_space);
+		}
 	}
 
-	uint32_t TryToReleaseRecursive(const uint32_t last_used_index, const uint32_t block_idx, Block*& block)
+	// After the elements are written. The flag is seen after the reservation.
+	void OnPublished()
 	{
-		if (!block)
-			return 0;
-		uint32_t removed = TryToReleaseRecursive(last_used_index, block_idx + 1, block->next);
-		const uint32_t first_index_in_block = block_idx * kSize;
-		if ((first_index_in_block > last_used_index) &&
-			!block->next &&
-			!block->written_num.load(std::memory_order_relaxed))
+		if (consumers_waiting_.load() && consumers_waiting_.exchange(false))
 		{
-			MoveToFreeList(block);
-			block = nullptr;
-			removed++;
+			std::lock_guard<std::mutex> lock(consumers_mutex_);
+			consumers_wake_.notify_all();
 		}
-		return removed;
 	}
 
-	void ReleaseEmptyBlocks()
+	void OnClaimed()
 	{
-		if (releasing_.test_and_set())
-			return;
-		State state = state_.load(std::memory_order_relaxed);
-		assert(state.block);
-		const uint32_t last_used_index = state.first + state.count;
-		assert(last_used_index < state.num_blocks* kSize);
-		const uint32_t removed = TryToReleaseRecursive(last_used_index, 1, state.block->next);
-#ifndef NDEBUG
-		if (removed)
+		if constexpr (kBounded)
 		{
-			State next_state;
-			do
+			if (producers_waiting_.load() && producers_waiting_.exchange(false))
 			{
-				next_state = state;
-				assert(next_state.num_blocks > removed);
-				next_state.num_blocks -= removed;
-			} while (!state_.compare_exchange_weak(state, next_state));
+				freed_space_.fetch_add(1);
+				freed_space_.notify_all();
+			}
 		}
-#endif	
-		releasing_.clear();
 	}
 
-	static std::pair<Block*, uint32_t> FindPopElement(const State state)
+	static void MarkWritten(Block* block, const uint32_t index_in_block)
 	{
-		Block* block = state.block;
-		assert(block);
-		const uint32_t consecutive_index = state.first + state.count;
-		assert(consecutive_index < state.num_blocks* kSize);
-		for (uint32_t it = kSize; it < consecutive_index; it += kSize)
+		assert(index_in_block < kSize);
+		// The block must not be accessed after this, a consumer can recycle it
+		const bool was_set = block->Written(index_in_block).test_and_set(std::memory_order_release);
+		assert(!was_set);
+	}
+
+	// The last reader of the block recycles it. The block must not be accessed after this.
+	void ClearBlockElement(Block* block, const uint32_t index_in_block)
+	{
+		block->Written(index_in_block).clear(std::memory_order_relaxed);
+		if (block->read_num.fetch_add(1, std::memory_order_acq_rel) + 1 == kSize)
 		{
-			block = block->next;
-			assert(block);
+			block->read_num.store(0, std::memory_order_relaxed);
+			GetEntry(block->index).block.store(nullptr, std::memory_order_release);
+			MoveToFreeList(block);
 		}
+	}
 
-		const uint32_t index_in_block = consecutive_index % kSize;
-		return std::pair<Block*, uint32_t>{block, index_in_block};
+	// Calls func(block, index_in_block) for num consecutive positions, in order. The block is looked up once per block.
+	template<typename Func>
+	void ForEachPosition(const Position first_position, const uint32_t num, Func& func)
+	{
+		Block* block = nullptr;
+		for (Position position = first_position; position != first_position + num; position++)
+		{
+			const uint32_t index_in_block = static_cast<uint32_t>(position % kSize);
+			if (!block || !index_in_block)
+			{
+				block = WaitForBlock(position / kSize);
+			}
+			func(block, index_in_block);
+		}
 	}
 
-	void ClearBlockElement(Block* block, uint32_t index_in_block)
+	template<typename Func>
+	void ReadElement(Block* block, const uint32_t index_in_block, Func& func)
 	{
-		block->written[index_in_block].clear();
-		assert(block->written_num);
-		const bool empty_block = !(--block->written_num);
-		if (empty_block)
+		while (!block->Written(index_in_block).test(std::memory_order_acquire))
 		{
-			ReleaseEmptyBlocks();
+			std::this_thread::yield();
 		}
+		T& element = *std::launder(reinterpret_cast<T*>(&block->Data(index_in_block)));
+		func(element);
+		element.~T();
+		ClearBlockElement(block, index_in_block);
 	}
 
 public:
@@ -213,61 +451,127 @@ public:
 	{
 		for (uint32_t i = 0; i < initial_blocks; i++)
 		{
-			MoveToFreeList(new Block());
+			MoveToFreeList(AllocateBlock());
 		}
 	}
 
 	~LockFreeQueue()
 	{
-		for (Block* it = state_.load().block; it;)
+		for (uint32_t i = 0; i < kDirectorySize; i++)
 		{
-			Block* to_delete = it;
-			it = it->next;
-			delete to_delete;
-		}
-
-		for (Block* it = free_list_head_; it;)
-		{
-			Block* to_delete = it;
-			it = it->next;
-			delete to_delete;
+			delete directory_[i].block.load();
 		}
+		DeleteFreeList();
 	}
 
+	// A bounded queue waits while it's full.
 	template<typename ...Args>
 	void Enqueue(Args&&... args)
 	{
-		const State local_state = PrepareSpaceForNewElement();
+		const Position position = Reserve(1);
+		Block* block = WaitForBlock(position / kSize);
+		const uint32_t index_in_block = static_cast<uint32_t>(position % kSize);
 
 		//WRITE DATA. Note this can be long operation and consumer may be blocked waiting for it.
-		auto space = &(local_state.block->data[local_state.first]);
-		T* result = ::new(space) T(std::forward<Args>(args)...);
+		::new(&block->Data(index_in_block)) T(std::forward<Args>(args)...);
 
 		//MARK THE ITEM AS WRITTEN
-		assert(local_state.first < kSize);
-		local_state.block->written_num++;
-		const bool was_set = local_state.block->written[local_state.first].test_and_set();
-		assert(!was_set);
-		local_state.block->written[local_state.first].notify_one();
+		MarkWritten(block, index_in_block);
+		OnPublished();
+	}
+
+	// Bounded only. Returns false, when the queue is full. Arguments are not consumed in such case.
+	template<typename ...Args>
+	bool TryEnqueue(Args&&... args)
+	{
+		const std::optional<Position> position = TryReserve(1);
+		if (!position)
+			return false;
+		Block* block = WaitForBlock(*position / kSize);
+		const uint32_t index_in_block = static_cast<uint32_t>(*position % kSize);
+		::new(&block->Data(index_in_block)) T(std::forward<Args>(args)...);
+		MarkWritten(block, index_in_block);
+		OnPublished();
+		return true;
+	}
+
+	// Holds the element until it fits into the queue. The suspended task is polled meanwhile.
+	class EnqueueAwaiter : public Coroutine::VeryBaseAwaiter
+	{
+		LockFreeQueue& queue_;
+		T element_;
+
+	public:
+		EnqueueAwaiter(LockFreeQueue& queue, T&& element) : queue_(queue), element_(std::move(element)) {}
+
+		bool await_ready() noexcept { return queue_.TryEnqueue(std::move(element_)); }
+
+		template<typename PromiseType>
+		void await_suspend(std::coroutine_handle<PromiseType> handle) noexcept
+		{
+			handle.promise().SetFunc([this]() -> bool { return queue_.TryEnqueue(std::move(element_)); });
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	// Bounded only. Suspends the task until there is room:
+	//	co_await Queue.EnqueueAsync(Job);
+	template<typename ...Args>
+	EnqueueAwaiter EnqueueAsync(Args&&... args)
+	{
+		static_assert(kBounded, "Only a bounded queue can be full");
+		return EnqueueAwaiter(*this, T(std::forward<Args>(args)...));
+	}
+
+	// Adds num elements with a single state update. construct(index) returns the element, index 0 is popped first.
+	// Elements are constructed in place (the returned value is not moved), the oldest first.
+	template<typename Construct>
+	void EnqueueBulk(const uint32_t num, Construct&& construct)
+	{
+		if (!num)
+			return;
+		const Position first_position = Reserve(num);
+		uint32_t element_index = 0;
+		auto Write = [&](Block* block, uint32_t index_in_block)
+		{
+			::new(&block->Data(index_in_block)) T(construct(element_index++));
+			MarkWritten(block, index_in_block);
+		};
+		ForEachPosition(first_position, num, Write);
+		OnPublished();
 	}
 
 	// Use to store immovable objects
 	template<typename Transform, typename ReturnType = decltype((*(Transform*)0)(*(T*)0))>
 	std::optional<ReturnType> Pop(Transform func = [](T& t) -> T { return std::move(t); })
 	{
-		const std::optional<State> local_state = TryDecrement();
-		if (!local_state)
+		uint32_t num = 0;
+		const std::optional<Position> position = positions_.TryClaim(1, num);
+		if (!position)
 			return {};
+		OnClaimed();
 
-		auto [block, index_in_block] = FindPopElement(*local_state);
+		std::optional<ReturnType> result;
+		auto Read = [&](T& element) { result.emplace(func(element)); };
+		ReadElement(WaitForBlock(*position / kSize), static_cast<uint32_t>(*position % kSize), Read);
+		return result;
+	}
 
-		block->written[index_in_block].wait(false);
-		T& transofmable = *std::launder(reinterpret_cast<T*>(&(block->data[index_in_block])));
-		std::optional<ReturnType> result(func(transofmable));
-		transofmable.~T();
+	// Claims up to max_num oldest elements with a single state update. func(T&) is called for each of them, the oldest first.
+	// Returns number of popped elements.
+	template<typename Func>
+	uint32_t PopBulk(const uint32_t max_num, Func&& func)
+	{
+		uint32_t num = 0;
+		const std::optional<Position> first_position = max_num ? positions_.TryClaim(max_num, num) : std::optional<Position>{};
+		if (!first_position)
+			return 0;
+		OnClaimed();
 
-		ClearBlockElement(block, index_in_block);
-		return result;
+		auto Read = [&](Block* block, uint32_t index_in_block) { ReadElement(block, index_in_block, func); };
+		ForEachPosition(*first_position, num, Read);
+		return num;
 	}
 
 	std::optional<T> Pop()
@@ -276,13 +580,69 @@ public:
 		return Pop(JustMove);
 	}
 
-	uint32_t Num() const { return state_.load(std::memory_order_relaxed).count; }
+	// Waits up to the timeout, when the queue is empty. The consumer tries for a while, then sleeps until a producer notifies.
+	template<typename Rep, typename Period>
+	std::optional<T> PopFor(const std::chrono::duration<Rep, Period> timeout)
+	{
+		constexpr uint32_t kYields = 64;
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		for (uint32_t tries = 0; true; tries++)
+		{
+			if (std::optional<T> element = Pop())
+				return element;
+			if (tries < kYields)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(consumers_mutex_);
+			consumers_waiting_.store(true);
+			if (!positions_.Num(std::memory_order_seq_cst)
+				&& consumers_wake_.wait_until(lock, deadline) == std::cv_status::timeout)
+			{
+				lock.unlock();
+				return Pop();
+			}
+		}
+	}
+
+	uint32_t Num() const { return positions_.Num(); }
+
+	// Blocks currently allocated, with or without elements.
+	uint32_t NumAllocatedBlocks() const { return allocated_blocks_.load(std::memory_order_relaxed); }
 
+	uint32_t NumFreeBlocks() const { return free_blocks_->Num(); }
+
+	// High-water mark of the free blocks. Blocks released above it are deleted right away.
+	void SetMaxFreeBlocks(const uint32_t max_num) { max_free_blocks_.store(max_num, std::memory_order_relaxed); }
+
+	// Deletes the free blocks, that were not needed since the previous call. Thread safe, call it periodically
+	// (from a timer or a background thread), so a burst doesn't keep its peak memory.
+	// Returns number of deleted blocks.
+	uint32_t TrimIdleBlocks()
+	{
+		const uint32_t idle = idle_free_blocks_.exchange(free_blocks_->Num(), std::memory_order_relaxed);
+		uint32_t deleted = 0;
+		for (; deleted < idle; deleted++)
+		{
+			std::optional<Block*> block = free_blocks_->Pop();
+			if (!block)
+				break;
+			DeleteBlock(*block);
+		}
+		idle_free_blocks_.store(free_blocks_->Num(), std::memory_order_relaxed);
+		return deleted;
+	}
+
+	// Thread safe.
 	void DeleteFreeList()
 	{
-		for (Block* block = GetBlockFromFreeList(); block; block = GetBlockFromFreeList())
+		while (std::optional<Block*> block = free_blocks_->Pop())
 		{
-			delete block;
+			DeleteBlock(*block);
 		}
 	}
 };
+
+template<typename T, uint32_t kSize, uint32_t kMaxNum = UINT16_MAX, bool kBounded = false>
+using PaddedLockFreeQueue = LockFreeQueue<T, kSize, kMaxNum, kBounded, true>;
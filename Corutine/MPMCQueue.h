@@ -0,0 +1,180 @@
+#pragma once
+
+#include<atomic>
+#include<optional>
+#include<thread>
+#include<new>
+#include<assert.h>
+
+// Bounded queue for multiple producers and multiple consumers. A ring of slots, each slot has a sequence number:
+//	- sequence == position: the slot is free for the producer claiming the position,
+//	- sequence == position + 1: the element is written, the consumer claiming the position can read it,
+//	- sequence == position + kCapacity: the element was consumed, the slot is free for the next lap.
+// A position is claimed by a CAS on the producer (or consumer) counter, then the slot is accessed only by the claiming thread.
+// Nothing is allocated after the construction and no thread waits for another one, unless the queue is full.
+// Elements are constructed and consumed in place, so they don't have to be movable.
+template<typename T, uint32_t kCapacity>
+class MPMCQueue
+{
+	static_assert(kCapacity >= 2 && !(kCapacity & (kCapacity - 1)), "Capacity has to be a power of 2");
+
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+	MPMCQueue(const MPMCQueue&&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&&) = delete;
+
+	static constexpr uint32_t kCacheLine = 64;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;
+		std::aligned_storage_t<sizeof(T), alignof(T)> data;
+	};
+
+	Slot slots_[kCapacity];
+	// Producers and consumers don't share a cache line
+	alignas(kCacheLine) std::atomic<uint64_t> enqueue_pos_ = 0;
+	alignas(kCacheLine) std::atomic<uint64_t> dequeue_pos_ = 0;
+
+	Slot& GetSlot(uint64_t position) { return slots_[position & (kCapacity - 1)]; }
+
+	// Returns the slot owned by the caller, or nullptr when there is no slot with the expected sequence.
+	Slot* Claim(std::atomic<uint64_t>& counter, const uint64_t lap_offset, uint64_t& out_position)
+	{
+		uint64_t position = counter.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& slot = GetSlot(position);
+			const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const int64_t diff = static_cast<int64_t>(sequence - (position + lap_offset));
+			if (!diff)
+			{
+				if (counter.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					out_position = position;
+					return &slot;
+				}
+			}
+			else if (diff < 0)
+			{
+				// Full for producers, empty for consumers
+				return nullptr;
+			}
+			else
+			{
+				// Other thread claimed the position meanwhile
+				position = counter.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+public:
+	MPMCQueue()
+	{
+		for (uint32_t i = 0; i < kCapacity; i++)
+		{
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~MPMCQueue()
+	{
+		while (Pop([](T&) { return true; })) {}
+	}
+
+	// Returns false, when the queue is full. Arguments are not consumed in such case.
+	template<typename ...Args>
+	bool TryEnqueue(Args&&... args)
+	{
+		uint64_t position = 0;
+		Slot* slot = Claim(enqueue_pos_, 0, position);
+		if (!slot)
+			return false;
+
+		::new(&slot->data) T(std::forward<Args>(args)...);
+		slot->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Claims up to num consecutive free slots with a single CAS. construct(index) returns the element, index 0 is popped first.
+	// Elements are constructed in place (the returned value is not moved). Returns number of added elements, 0 when the queue is full.
+	template<typename Construct>
+	uint32_t TryEnqueueBulk(const uint32_t num, Construct&& construct)
+	{
+		uint64_t position = enqueue_pos_.load(std::memory_order_relaxed);
+		uint32_t claimed = 0;
+		while (num)
+		{
+			// A free slot can't be taken by other producer, without claiming its position first
+			while (claimed < num && GetSlot(position + claimed).sequence.load(std::memory_order_acquire) == position + claimed)
+			{
+				claimed++;
+			}
+			if (claimed)
+			{
+				if (enqueue_pos_.compare_exchange_weak(position, position + claimed, std::memory_order_relaxed))
+					break;
+				claimed = 0;
+			}
+			else if (static_cast<int64_t>(GetSlot(position).sequence.load(std::memory_order_relaxed) - position) < 0)
+			{
+				return 0;
+			}
+			else
+			{
+				position = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		for (uint32_t index = 0; index < claimed; index++)
+		{
+			Slot& slot = GetSlot(position + index);
+			::new(&slot.data) T(construct(index));
+			slot.sequence.store(position + index + 1, std::memory_order_release);
+		}
+		return claimed;
+	}
+
+	// Yields while the queue is full.
+	template<typename ...Args>
+	void Enqueue(Args&&... args)
+	{
+		while (!TryEnqueue(std::forward<Args>(args)...))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// Use to store immovable objects. The element is destroyed after the func returns.
+	// Returns nothing when the queue is empty, or when the oldest element is still being written.
+	template<typename Transform, typename ReturnType = decltype((*(Transform*)0)(*(T*)0))>
+	std::optional<ReturnType> Pop(Transform func)
+	{
+		uint64_t position = 0;
+		Slot* slot = Claim(dequeue_pos_, 1, position);
+		if (!slot)
+			return {};
+
+		T& transformable = *std::launder(reinterpret_cast<T*>(&slot->data));
+		std::optional<ReturnType> result(func(transformable));
+		transformable.~T();
+		slot->sequence.store(position + kCapacity, std::memory_order_release);
+		return result;
+	}
+
+	std::optional<T> Pop()
+	{
+		auto JustMove = [](T& t) -> T { return std::move(t); };
+		return Pop(JustMove);
+	}
+
+	// Approximation, when other threads are active.
+	uint32_t Num() const
+	{
+		const uint64_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+		const uint64_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+		return enqueued > dequeued ? static_cast<uint32_t>(enqueued - dequeued) : 0;
+	}
+
+	static constexpr uint32_t Capacity() { return kCapacity; }
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "Promise.h"
+#include "ReadyQueue.h"
+
+namespace Coroutine
+{
+	template <typename T> class OneShot;
+	template <typename T> class OneShotSender;
+
+	// Shared state of a single value channel. Lock free, no mutex, no system calls.
+	// Allocated from the FramePool by MakeOneShot, or placed inline by the user (see Connect).
+	template <typename T>
+	class OneShotState
+	{
+		static_assert(!std::is_void_v<T>, "Use OneShot<std::monostate> for a signal without value.");
+
+		enum EState : uint32_t
+		{
+			Empty,
+			Waiting,	// Receiver registered its WakeBinding
+			Ready,
+			Abandoned	// Sender was released without a value
+		};
+
+		std::atomic<uint32_t> State = Empty;
+		std::atomic<uint32_t> RefCount = 0;
+		std::atomic_flag Notified;	// Sender finished with the registered wake
+		const bool bInline;
+		WakeBinding Wake;
+		std::aligned_storage_t<sizeof(T), alignof(T)> Value;
+
+		friend OneShot<T>;
+		friend OneShotSender<T>;
+		template <typename U> friend std::pair<OneShot<U>, OneShotSender<U>> MakeOneShot();
+
+		explicit OneShotState(bool bInInline) : bInline(bInInline) {}
+
+		T& GetValue() { return *std::launder(reinterpret_cast<T*>(&Value)); }
+
+		bool IsFinished() const
+		{
+			const uint32_t Current = State.load(std::memory_order_acquire);
+			return Current == Ready || Current == Abandoned;
+		}
+
+		// Returns false when the value is already there.
+		bool RegisterWake(const WakeBinding& InWake)
+		{
+			Wake = InWake;
+			uint32_t Expected = Empty;
+			return State.compare_exchange_strong(Expected, Waiting, std::memory_order_acq_rel);
+		}
+
+		// The receiver gives up waiting (it's destroyed). After it returns, the wake won't be pushed anymore.
+		void UnregisterWake()
+		{
+			uint32_t Expected = Waiting;
+			if (!State.compare_exchange_strong(Expected, Empty, std::memory_order_acq_rel))
+			{
+				Notified.wait(false, std::memory_order_acquire);
+			}
+		}
+
+		void Finish(EState Final)
+		{
+			const uint32_t Prev = State.exchange(Final, std::memory_order_acq_rel);
+			assert(Prev == Empty || Prev == Waiting);
+			if (Prev == Waiting)
+			{
+				if (Wake)
+				{
+					Wake.Notify();
+				}
+				Notified.test_and_set(std::memory_order_release);
+				Notified.notify_one();
+			}
+		}
+
+		void AddRef() { RefCount.fetch_add(1, std::memory_order_relaxed); }
+
+		void RemoveRef()
+		{
+			if (RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1 && !bInline)
+			{
+				this->~OneShotState();
+				FramePool::Free(this, sizeof(OneShotState));
+			}
+		}
+
+		OneShotState(const OneShotState&) = delete;
+		OneShotState& operator=(const OneShotState&) = delete;
+
+	public:
+		// Inline state. It has to outlive both connected halves.
+		OneShotState() : OneShotState(true) {}
+
+		~OneShotState()
+		{
+			assert(!RefCount.load(std::memory_order_relaxed));
+			if (State.load(std::memory_order_relaxed) == Ready)
+			{
+				GetValue().~T();
+			}
+		}
+
+		// Connects halves to the inline state. Can be called once.
+		std::pair<OneShot<T>, OneShotSender<T>> Connect()
+		{
+			assert(bInline && State.load(std::memory_order_relaxed) == Empty);
+			return { OneShot<T>(this), OneShotSender<T>(this) };
+		}
+	};
+
+	// Sending half. Releasing it without sending a value wakes the receiver with an empty result.
+	template <typename T>
+	class OneShotSender
+	{
+		OneShotState<T>* Shared = nullptr;
+
+		friend OneShotState<T>;
+		template <typename U> friend std::pair<OneShot<U>, OneShotSender<U>> MakeOneShot();
+		explicit OneShotSender(OneShotState<T>* InShared) : Shared(InShared) { Shared->AddRef(); }
+
+	public:
+		OneShotSender() = default;
+		OneShotSender(OneShotSender&& Other) : Shared(std::exchange(Other.Shared, nullptr)) {}
+		OneShotSender& operator=(OneShotSender&& Other)
+		{
+			Reset();
+			Shared = std::exchange(Other.Shared, nullptr);
+			return *this;
+		}
+		OneShotSender(const OneShotSender&) = delete;
+		OneShotSender& operator=(const OneShotSender&) = delete;
+		~OneShotSender() { Reset(); }
+
+		// Thread safe. Can be called once, the sender is released after.
+		template <typename... Args>
+		void Send(Args&&... args)
+		{
+			assert(Shared);
+			::new(&Shared->Value) T(std::forward<Args>(args)...);
+			Shared->Finish(OneShotState<T>::Ready);
+			Shared->RemoveRef();
+			Shared = nullptr;
+		}
+
+		void Reset()
+		{
+			if (Shared)
+			{
+				Shared->Finish(OneShotState<T>::Abandoned);
+				Shared->RemoveRef();
+				Shared = nullptr;
+			}
+		}
+	};
+
+	// Receiving half. Awaiting it costs one atomic load. A bound task is pushed to its ReadyQueue by the sender.
+	//	std::optional<T> Value = co_await Receiver;
+	template <typename T>
+	class OneShot : public VeryBaseAwaiter
+	{
+		OneShotState<T>* Shared = nullptr;
+		bool bWakeRegistered = false;
+
+		friend OneShotState<T>;
+		template <typename U> friend std::pair<OneShot<U>, OneShotSender<U>> MakeOneShot();
+		explicit OneShot(OneShotState<T>* InShared) : Shared(InShared) { Shared->AddRef(); }
+
+	public:
+		OneShot() = default;
+		OneShot(OneShot&& Other) 
+			: Shared(std::exchange(Other.Shared, nullptr))
+			, bWakeRegistered(std::exchange(Other.bWakeRegistered, false))
+		{}
+		OneShot& operator=(OneShot&& Other)
+		{
+			Reset();
+			Shared = std::exchange(Other.Shared, nullptr);
+			bWakeRegistered = std::exchange(Other.bWakeRegistered, false);
+			return *this;
+		}
+		OneShot(const OneShot&) = delete;
+		OneShot& operator=(const OneShot&) = delete;
+		~OneShot() { Reset(); }
+
+		void Reset()
+		{
+			if (Shared)
+			{
+				if (bWakeRegistered)
+				{
+					Shared->UnregisterWake();
+					bWakeRegistered = false;
+				}
+				Shared->RemoveRef();
+				Shared = nullptr;
+			}
+		}
+
+		bool IsReady() const { return !Shared || Shared->IsFinished(); }
+
+		// Obtains the value. Returns value only once, empty when there is no value (yet).
+		std::optional<T> Consume()
+		{
+			if (!Shared || Shared->State.load(std::memory_order_acquire) != OneShotState<T>::Ready)
+			{
+				return {};
+			}
+			auto Guard = MakeFnGuard([&]() { Reset(); });
+			return std::optional<T>(std::move(Shared->GetValue()));
+		}
+
+		bool await_ready() const noexcept { return IsReady(); }
+
+		template <typename PromiseType>
+		bool await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept
+		{
+			assert(Handle);
+			PromiseCore& Core = Handle.promise();
+			if (!Shared->RegisterWake(Core.GetWake()))
+			{
+				return false;
+			}
+			bWakeRegistered = true;
+			Core.WaitForEvent();
+			Core.SetFunc([this]() -> bool { return IsReady(); });
+			return true;
+		}
+
+		std::optional<T> await_resume() { return Consume(); }
+	};
+
+	// The shared state is allocated from the FramePool of the calling thread.
+	template <typename T>
+	std::pair<OneShot<T>, OneShotSender<T>> MakeOneShot()
+	{
+		using StateType = OneShotState<T>;
+		StateType* Shared = ::new(FramePool::Allocate(sizeof(StateType))) StateType(false);
+		return { OneShot<T>(Shared), OneShotSender<T>(Shared) };
+	}
+}
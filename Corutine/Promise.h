@@ -4,6 +4,13 @@
 #include <functional>
 #include <assert.h>
 #include <optional>
+#include <atomic>
+#include <thread>
+
+#include "FrameAllocator.h"
+#include "InlineFunction.h"
+#include "Cancellation.h"
+#include "Trace.h"
 
 #if defined(__clang__)
 #include "ClangCoroutine.h"
@@ -34,16 +41,419 @@ namespace Coroutine
 		Disconnected
 	};
 
+	class PromiseCore;
+	class ReadyQueue;
+
+	// Wake-up record of a child of WhenAll/WhenAny. Woken children are pushed to a list of their awaiter,
+	// so only they are resumed. The record is in the child frame, so it outlives every event source of the frame.
+	// The awaiter detaches the records before it's destroyed, later wake-ups of the children only wake the task.
+	class ChildWake
+	{
+		enum EState : uint8_t
+		{
+			Detached,
+			Idle,
+			Pushing,	// Being pushed to the list
+			Queued		// In the list, until the awaiter takes it
+		};
+
+		std::atomic<uint8_t> State = Detached;
+		uint32_t Index = 0;
+		ChildWake* Next = nullptr;
+		std::atomic<ChildWake*>* List = nullptr;	// Of the awaiter, valid until detached
+		ChildWake* Parent = nullptr;				// Record of the awaiting frame, when it's a child too
+
+		void WaitWhilePushing(uint8_t& Current)
+		{
+			std::this_thread::yield();
+			Current = State.load();
+		}
+
+	public:
+		// By the awaiter. The record isn't attached anywhere else.
+		void Attach(std::atomic<ChildWake*>& InList, ChildWake* InParent, uint32_t InIndex)
+		{
+			assert(State.load() == Detached);
+			List = &InList;
+			Parent = InParent;
+			Index = InIndex;
+			Next = nullptr;
+			State.store(Idle);
+		}
+
+		// By the awaiter. After it returns, no wake-up touches its list.
+		void Detach()
+		{
+			for (uint8_t Current = State.load(); Current != Detached;)
+			{
+				if (Current == Pushing)
+				{
+					WaitWhilePushing(Current);
+				}
+				else if (State.compare_exchange_weak(Current, Detached))
+				{
+					break;
+				}
+			}
+		}
+
+		// Thread safe. A queued record isn't pushed again, the RMW still publishes the event to the awaiter.
+		void Signal()
+		{
+			for (uint8_t Current = State.load();;)
+			{
+				if (Current == Detached)
+				{
+					return;
+				}
+				if (Current == Pushing)
+				{
+					WaitWhilePushing(Current);
+				}
+				else if (State.compare_exchange_weak(Current, Current == Idle ? uint8_t(Pushing) : Current))
+				{
+					if (Current == Queued)
+					{
+						return;
+					}
+					break;
+				}
+			}
+			ChildWake* Head = List->load();
+			do
+			{
+				Next = Head;
+			} while (!List->compare_exchange_weak(Head, this));
+			// Once queued, the awaiter may detach the record
+			ChildWake* ParentWake = Parent;
+			State.store(Queued);
+			if (ParentWake)
+			{
+				ParentWake->Signal();
+			}
+		}
+
+		// By the awaiter, for the records taken from its list. Returns index of the woken child.
+		// The record can be queued again from now on, so its successor has to be read before.
+		uint32_t Take()
+		{
+			for (uint8_t Current = Queued; !State.compare_exchange_weak(Current, Idle); Current = Queued)
+			{
+				assert(Current == Pushing || Current == Queued);
+				std::this_thread::yield();
+			}
+			return Index;
+		}
+
+		ChildWake* GetNext() const { return Next; }
+	};
+
+	// Where to report, that a suspended task can make progress. Empty when the task is polled.
+	struct WakeBinding
+	{
+		ReadyQueue* Queue = nullptr;
+		PromiseCore* Task = nullptr; // Task resumed by the owner of the queue
+		ChildWake* Child = nullptr;	// Innermost WhenAll/WhenAny child containing the waiting frame
+
+		explicit operator bool() const { return !!Queue; }
+
+		// Thread safe. Called by the event source.
+		void Notify() const;
+	};
+
 	class VeryBaseTask{};
+
+	// Awaiter usable by any task type. Passed by await_transform as is.
+	// await_suspend is a template taking std::coroutine_handle<PromiseType>, the promise is a PromiseCore.
+	struct VeryBaseAwaiter{};
+
 	struct VeryBaseAsync
 	{
 		// ReturnType
 		// Move ctor
-		// void Start()
+		// void Start(WakeBinding) - when bound, the task is pushed to the queue once the result is ready
 		// bool IsReady() const
 		// [ReturnType != void] ReturnType ConsumeResult()
 	};
 
+	// Opt-in switch for awaiting a task type through a continuation chain:
+	//	template <> struct ContinuationChain<UniqueTask<int>> : std::true_type {};
+	// The awaited frame is started by symmetric transfer and becomes the innermost frame of the chain.
+	// Resuming the root goes directly to the innermost frame and a finished frame transfers control back to its parent,
+	// so the cost of a resume doesn't depend on the nesting depth.
+	// While chained, the awaited task must not be resumed by anything else than the root of the chain.
+	template <typename TaskType> struct ContinuationChain : std::false_type {};
+
+	// Capacity of the inline storage for suspension predicates. Big enough for a std::function.
+	constexpr std::size_t kPredicateCapacity = 64;
+
+	// Untyped part of every promise. Frames of a continuation chain refer to each other through it.
+	class PromiseCore
+	{
+		friend ReadyQueue;
+
+		InlineFunction<bool(), kPredicateCapacity> Func;
+		EStatus State = EStatus::Suspended;
+		std::coroutine_handle<> Handle;
+
+		WakeBinding Wake;
+		ChildWake WakeRecord;			// [WhenAll/WhenAny child only]
+		CancellationToken Cancellation;
+		bool bEventWait = false;		// [Bound task only] Some awaited frame will push the task to the queue
+		uint32_t OwnerIndex = 0;		// [Bound task only] Free to use by the owner of the queue
+
+		PromiseCore* Parent = nullptr;	// Awaiting frame, continued when this one is done
+		PromiseCore* Root = nullptr;	// Frame resumed by the owner of the chain
+		PromiseCore* Leaf = nullptr;	// [Root only] Innermost frame of the chain. Nullptr when the root itself is innermost.
+
+#if COROUTINE_TRACE
+		const char* TraceName = nullptr;
+		std::source_location TraceLocation;
+		int64_t TraceSuspendedAt = -1;
+
+		// Called on the frame about to be resumed. In a continuation chain the frame can be destroyed by its parent
+		// before the resume returns, so everything about it is read now.
+		Trace::Event BeginTraceResume() const
+		{
+			const int64_t Begin = Trace::Now();
+			Trace::Event Event = MakeTraceEvent(Trace::EKind::Resume, Begin, Begin);
+			Event.SuspendedNs = (TraceSuspendedAt >= 0) ? Begin - TraceSuspendedAt : -1;
+			return Event;
+		}
+
+		// Called on the root, after the resume. Only the root and the frame, that suspended, are alive.
+		void EndTraceResume(Trace::Event& Event)
+		{
+			PromiseCore* Current = Leaf ? Leaf : this;
+			Event.EndNs = Trace::Now();
+			Event.Reason = (Current->State == EStatus::Done) ? "done"
+				: (Wake && Wake.Task->bEventWait) ? "event"
+				: Current->Func ? "poll" : "suspend";
+			Current->TraceSuspendedAt = Event.EndNs;
+			Trace::Write(Event);
+		}
+#endif
+
+		bool TryClearFunc()
+		{
+			if (Func && !Func())
+			{
+				return false;
+			}
+			Func.Reset();
+			return true;
+		}
+
+		std::coroutine_handle<> OnFinalSuspend() noexcept
+		{
+			if (!Parent)
+			{
+				return std::noop_coroutine();
+			}
+			State = EStatus::Done;
+			Parent->State = EStatus::Resuming;
+			Root->Leaf = (Parent == Root) ? nullptr : Parent;
+			return Parent->Handle;
+		}
+
+	protected:
+		struct FinalAwaiter
+		{
+			PromiseCore* Core;
+
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept { return Core->OnFinalSuspend(); }
+			void await_resume() noexcept {}
+		};
+
+		void SetHandle(std::coroutine_handle<> InHandle) { Handle = InHandle; }
+
+#if COROUTINE_TRACE
+		void SetTraceLocation(const std::source_location& Location) { TraceLocation = Location; }
+#endif
+
+	public:
+		template <typename Fn>
+		void SetFunc(Fn&& InFunc)
+		{
+			assert(!Func);
+			Func.Emplace(std::forward<Fn>(InFunc));
+		}
+		EStatus Status() const { return State; }
+
+		// Awaited frames report to the same queue as the awaiting one, and are cancelled with it.
+		// A frame with own cancellation token keeps it.
+		void InheritFrom(const PromiseCore& Awaiting)
+		{
+			Wake = Awaiting.Wake;
+			if (!Cancellation)
+			{
+				Cancellation = Awaiting.Cancellation;
+			}
+		}
+
+		void SetCancellation(CancellationToken InToken) { Cancellation = InToken; }
+
+		// [Bound frame only] Wake-ups of this frame, and of the frames it awaits, are recorded in the list too.
+		// Call after InheritFrom.
+		void AttachChildWake(std::atomic<ChildWake*>& List, uint32_t Index)
+		{
+			assert(Wake);
+			WakeRecord.Attach(List, Wake.Child, Index);
+			Wake.Child = &WakeRecord;
+		}
+
+		void DetachChildWake() { WakeRecord.Detach(); }
+
+		// The next Resume finishes the task, or its innermost frame.
+		bool IsCancelPending() const
+		{
+			return Cancellation.IsCancelled() || (Leaf && Leaf->Cancellation.IsCancelled());
+		}
+
+		// Shown in the trace instead of the coroutine function. The string has to outlive the trace.
+#if COROUTINE_TRACE
+		void SetTraceName(const char* InName) { TraceName = InName; }
+
+		Trace::Event MakeTraceEvent(Trace::EKind Kind, int64_t Begin, int64_t End) const
+		{
+			Trace::Event Event;
+			Event.Name = TraceName ? TraceName : TraceLocation.function_name();
+			Event.File = TraceLocation.file_name();
+			Event.Line = TraceLocation.line();
+			Event.Kind = Kind;
+			Event.BeginNs = Begin;
+			Event.EndNs = End;
+			Event.Frame = this;
+			return Event;
+		}
+#else
+		void SetTraceName(const char*) {}
+#endif
+
+		const WakeBinding& GetWake() const { return Wake; }
+		std::coroutine_handle<> GetCoroutine() const { return Handle; }
+		uint32_t GetOwnerIndex() const { return OwnerIndex; }
+		void SetOwnerIndex(uint32_t InIndex) { OwnerIndex = InIndex; }
+
+		// Called by an awaiter, that will push the bound task to its queue when it's ready.
+		// The task isn't polled until then.
+		WakeBinding WaitForEvent()
+		{
+			if (Wake)
+			{
+				Wake.Task->bEventWait = true;
+			}
+			return Wake;
+		}
+
+		// For awaiters resuming several frames from one predicate (WhenAll, WhenAny).
+		// Returns whether the frames resumed since the last call wait for an event, and clears the mark.
+		bool TakeEventWait()
+		{
+			if (!Wake)
+			{
+				return false;
+			}
+			const bool bResult = Wake.Task->bEventWait;
+			Wake.Task->bEventWait = false;
+			return bResult;
+		}
+
+		void Resume()
+		{
+			assert(State != EStatus::Resuming);
+			if (State != EStatus::Suspended)
+			{
+				return;
+			}
+			// Frames inside a continuation chain are resumed through the root
+			assert(!Parent);
+
+			// The frame is not resumed anymore. Awaited frames are destroyed together with it.
+			if (Cancellation.IsCancelled())
+			{
+				State = EStatus::Done;
+				return;
+			}
+
+			PromiseCore* Target = Leaf ? Leaf : this;
+			// Innermost frame cancelled by its own token, its parent continues without a result
+			while (Target != this && Target->Cancellation.IsCancelled())
+			{
+				Target->State = EStatus::Done;
+				Target = Target->Parent;
+				Leaf = (Target == this) ? nullptr : Target;
+			}
+
+			if (!Target->TryClearFunc())
+			{
+				return;
+			}
+
+			assert(Target->Handle);
+#if COROUTINE_TRACE
+			Trace::Event TraceEvent = Target->BeginTraceResume();
+			auto TraceGuard = MakeFnGuard([this, &TraceEvent]() { EndTraceResume(TraceEvent); });
+#endif
+			Target->State = EStatus::Resuming;
+			Target->Handle.resume();
+
+			// Control could be transferred along the chain, the innermost frame is the one that suspended
+			PromiseCore* Current = Leaf ? Leaf : this;
+			if (Current->Handle.done())
+			{
+				Current->State = EStatus::Done;
+			}
+			else if (Current->State == EStatus::Resuming)
+			{
+				Current->State = EStatus::Suspended;
+			}
+		}
+
+		// Resumes a task bound to a queue.
+		// Returns true, when the task should be resumed again without waiting for an event.
+		bool ResumeBound()
+		{
+			assert(Wake && Wake.Task == this);
+			bEventWait = false;
+			Resume();
+			return State == EStatus::Suspended && !bEventWait;
+		}
+
+		// Links this frame (with its own chain, if any) under the running Awaiting frame and suspends the Awaiting frame.
+		// Returns the frame that should continue.
+		std::coroutine_handle<> StartChained(PromiseCore& Awaiting) noexcept
+		{
+			assert(!Parent);
+			assert(State == EStatus::Suspended);
+			PromiseCore& NewRoot = Awaiting.Root ? *Awaiting.Root : Awaiting;
+			Parent = &Awaiting;
+			Root = &NewRoot;
+			InheritFrom(Awaiting);
+
+			PromiseCore* Innermost = this;
+			if (Leaf)
+			{
+				for (PromiseCore* It = Leaf; It != this; It = It->Parent)
+				{
+					It->Root = &NewRoot;
+				}
+				Innermost = Leaf;
+				Leaf = nullptr;
+			}
+			NewRoot.Leaf = Innermost;
+			Awaiting.State = EStatus::Suspended;
+
+			if (!Innermost->TryClearFunc())
+			{
+				return std::noop_coroutine();
+			}
+			Innermost->State = EStatus::Resuming;
+			return Innermost->Handle;
+		}
+	};
+
 	template <typename AsyncType, typename PromiseType>
 	struct AsyncAwaiter
 	{
@@ -57,9 +467,13 @@ namespace Coroutine
 
 		void await_suspend(HandleType Handle) noexcept
 		{
-			Functor.Start();
 			assert(Handle);
 			Handle.promise().SetFunc([this]() -> bool { return Functor.IsReady(); });
+#if COROUTINE_TRACE
+			const int64_t Now = Trace::Now();
+			Trace::Write(Handle.promise().MakeTraceEvent(Trace::EKind::Async, Now, Now));
+#endif
+			Functor.Start(Handle.promise().WaitForEvent());
 		}
 
 		auto await_resume() noexcept 
@@ -86,6 +500,8 @@ namespace Coroutine
 		}
 		bool await_suspend(HandleType Handle) noexcept
 		{
+			assert(Handle);
+			InnerTask.GetCore()->InheritFrom(Handle.promise());
 			auto ResumeTask = [this]() -> bool
 			{
 				InnerTask.Resume();
@@ -111,6 +527,47 @@ namespace Coroutine
 		}
 	};
 
+	template <typename TaskType, typename ReturnType, typename PromiseType>
+	struct ChainedTaskAwaiter
+	{
+		using HandleType = std::coroutine_handle<PromiseType>;
+
+		TaskType InnerTask;
+
+		bool await_ready() noexcept
+		{
+			const EStatus Status = InnerTask.Status();
+			assert(Status != EStatus::Resuming);
+			return Status != EStatus::Suspended;
+		}
+		std::coroutine_handle<> await_suspend(HandleType Handle) noexcept
+		{
+			PromiseCore* Inner = InnerTask.GetCore();
+			assert(Inner && Handle);
+			return Inner->StartChained(Handle.promise());
+		}
+		auto await_resume() noexcept
+		{
+			auto Guard = MakeFnGuard([&]() { InnerTask.Reset(); });
+			if constexpr (!std::is_void_v<ReturnType>)
+			{
+				return InnerTask.Consume();
+			}
+		}
+	};
+
+	// Awaits an awaiter owned by someone else, without copying it.
+	template <typename AwaiterType>
+	struct AwaiterRef
+	{
+		AwaiterType& Awaiter;
+
+		bool await_ready() noexcept { return Awaiter.await_ready(); }
+		template <typename PromiseType>
+		auto await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept { return Awaiter.await_suspend(Handle); }
+		decltype(auto) await_resume() { return Awaiter.await_resume(); }
+	};
+
 	template <typename Return, typename PromiseType>
 	struct FutureAwaiter
 	{
@@ -161,15 +618,12 @@ namespace Coroutine
 	};
 
 	template <typename Return, typename Yield, typename PromiseType, typename TaskType> 
-	class PromiseBase
+	class PromiseBase : public PromiseCore
 	{
 	public:
 		using HandleType = std::coroutine_handle<PromiseType>;
 
 	private:
-		std::function<bool()> Func;
-		EStatus State = EStatus::Suspended;
-
 		HandleType GetHandle()
 		{
 			return HandleType::from_promise(
@@ -177,49 +631,48 @@ namespace Coroutine
 		}
 
 	public:
-		std::suspend_always initial_suspend() noexcept { return {}; }
-		std::suspend_always final_suspend() noexcept { return {}; }
-		void unhandled_exception() {}
-		TaskType get_return_object() noexcept
+		// Frames of task types marked with PooledFrames are recycled by the per-thread FramePool.
+		static void* operator new(std::size_t Size)
 		{
-			return TaskType(GetHandle());
+			if constexpr (PooledFrames<TaskType>::value)
+			{
+				return FramePool::Allocate(Size);
+			}
+			else
+			{
+				return ::operator new(Size);
+			}
 		}
 
-	public:
-		void SetFunc(std::function<bool()> InFunc)
-		{
-			assert(!Func);
-			Func = std::move(InFunc);
-		}
-		EStatus Status() const { return State; }
-		void Resume()
+		static void operator delete(void* Ptr, std::size_t Size) noexcept
 		{
-			assert(State != EStatus::Resuming);
-			if (State != EStatus::Suspended)
+			if constexpr (PooledFrames<TaskType>::value)
 			{
-				return;
+				FramePool::Free(Ptr, Size);
 			}
-
-			if (Func && !Func())
+			else
 			{
-				return;
+				::operator delete(Ptr);
 			}
-			Func = nullptr;
+		}
 
-			{
-				HandleType LocalHandle = GetHandle();
-				assert(LocalHandle);
-				State = EStatus::Resuming;
-				LocalHandle.resume();
-				if (LocalHandle.done())
-				{
-					State = EStatus::Done;
-				}
-				else if (State == EStatus::Resuming)
-				{
-					State = EStatus::Suspended;
-				}
-			}
+	public:
+#if COROUTINE_TRACE
+		// The default argument is evaluated in the coroutine, so it's the location of the coroutine function.
+		std::suspend_always initial_suspend(std::source_location Location = std::source_location::current()) noexcept
+		{
+			SetTraceLocation(Location);
+			return {};
+		}
+#else
+		std::suspend_always initial_suspend() noexcept { return {}; }
+#endif
+		FinalAwaiter final_suspend() noexcept { return FinalAwaiter{ this }; }
+		void unhandled_exception() {}
+		TaskType get_return_object() noexcept
+		{
+			SetHandle(GetHandle());
+			return TaskType(GetHandle());
 		}
 
 	public:
@@ -244,22 +697,14 @@ namespace Coroutine
 			bool bSuspend;
 		};
 
-		auto await_transform(const std::function<bool()>& InFunc)
-		{
-			const bool bSuspend = !InFunc();
-			if (bSuspend)
-			{
-				SetFunc(InFunc);
-			}
-			return SuspendIf(bSuspend);
-		}
-
-		auto await_transform(std::function<bool()>&& InFunc)
+		// Any predicate (lambda, std::function, etc.) is stored in place, without allocation.
+		template <typename Fn, std::enable_if_t<std::is_invocable_r_v<bool, std::decay_t<Fn>&>, int> = 0>
+		auto await_transform(Fn&& InFunc)
 		{
 			const bool bSuspend = !InFunc();
 			if (bSuspend)
 			{
-				SetFunc(std::forward<std::function<bool()>>(InFunc));
+				SetFunc(std::forward<Fn>(InFunc));
 			}
 			return SuspendIf(bSuspend);
 		}
@@ -270,6 +715,20 @@ namespace Coroutine
 			return AsyncAwaiter<AsyncType, PromiseType>{std::forward<AsyncType>(InAsync)};
 		}
 
+		template <typename AwaiterType, std::enable_if_t<std::is_base_of_v<VeryBaseAwaiter, std::decay_t<AwaiterType>>, int> = 0>
+		auto await_transform(AwaiterType&& InAwaiter)
+		{
+			if constexpr (std::is_lvalue_reference_v<AwaiterType>)
+			{
+				return AwaiterRef<std::remove_reference_t<AwaiterType>>{ InAwaiter };
+			}
+			else
+			{
+				return std::move(InAwaiter);
+			}
+		}
+
+		// Slow path, polls the future. Prefer OneShot.
 		template <typename U>
 		auto await_transform(std::future<U>&& InReadyFunc)
 		{
@@ -277,11 +736,20 @@ namespace Coroutine
 				std::forward<std::future<U>>(InReadyFunc)};
 		}
 
-		template <typename InnerTaskType, std::enable_if_t<std::is_base_of_v<VeryBaseTask, InnerTaskType>, int> = 0>
+		template <typename InnerTaskType, std::enable_if_t<std::is_base_of_v<VeryBaseTask, std::decay_t<InnerTaskType>>, int> = 0>
 		auto await_transform(InnerTaskType&& InTask)
 		{
-			return TaskAwaiter<InnerTaskType, typename InnerTaskType::ReturnType, PromiseType>{
-				std::forward<InnerTaskType>(InTask)};
+			using ReturnType = typename std::decay_t<InnerTaskType>::ReturnType;
+			if constexpr (ContinuationChain<std::decay_t<InnerTaskType>>::value)
+			{
+				return ChainedTaskAwaiter<InnerTaskType, ReturnType, PromiseType>{
+					std::forward<InnerTaskType>(InTask)};
+			}
+			else
+			{
+				return TaskAwaiter<InnerTaskType, ReturnType, PromiseType>{
+					std::forward<InnerTaskType>(InTask)};
+			}
 		}
 	};
 
@@ -308,6 +776,10 @@ namespace Coroutine
 			auto Guard = MakeFnGuard([&]() { Value.reset(); });
 			return std::move(Value);
 		}
+		const std::optional<Return>& PeekResult() const
+		{
+			return Value;
+		}
 	};
 
 	template <typename Yield, typename PromiseType, typename TaskType>
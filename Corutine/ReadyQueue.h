@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Promise.h"
+#include "LockFreeQueue.h"
+
+namespace Coroutine
+{
+	// Tasks, that can make progress. Any thread can push, only the owner drains.
+	// A bound task is resumed only from the queue:
+	//	- when it waits for an event (Async), it's pushed back by the event and costs nothing until then,
+	//	- when it waits for anything else (predicate, other task, suspend_always), it's pushed back right away and polled on each Drain.
+	// Bound tasks have to stay alive until they are Done. They must not be resumed in other way.
+	// A finished task may still have stale wake-ups in the queue (from cancelled event sources), release it after the next Drain.
+	class ReadyQueue
+	{
+	public:
+		// Wake-ups pushed between two drains. One event (e.g. a timer tick) can wake every task of a scheduler at once.
+		static constexpr uint32_t kMaxPending = 1 << 20;
+
+	private:
+		LockFreeQueue<PromiseCore*, 256, kMaxPending> Ready;
+
+	public:
+		// Thread safe
+		void Push(PromiseCore* Core)
+		{
+			assert(Core);
+			Ready.Enqueue(Core);
+		}
+
+		// The task reports to this queue from now on.
+		void Bind(PromiseCore& Core)
+		{
+			assert(Core.Status() == EStatus::Suspended);
+			assert(!Core.Wake);
+			Core.Wake = WakeBinding{ this, &Core };
+		}
+
+		// Binds the task. It's resumed with the next Drain.
+		template <typename TaskType>
+		void Add(TaskType& Task)
+		{
+			PromiseCore* Core = Task.GetCore();
+			assert(Core);
+			Bind(*Core);
+			Push(Core);
+		}
+
+		// Only the owner. For owners driving the tasks themselves, instead of Drain.
+		std::optional<PromiseCore*> Pop()
+		{
+			return Ready.Pop();
+		}
+
+		// Resumes tasks from the queue. Tasks pushed meanwhile wait for the next call.
+		// Returns number of resumed tasks.
+		uint32_t Drain()
+		{
+			// The tasks are claimed at once, re-pushed ones are behind them
+			return Ready.PopBulk(Ready.Num(), [this](PromiseCore* Core)
+			{
+				if (Core->ResumeBound())
+				{
+					Ready.Enqueue(Core);
+				}
+			});
+		}
+
+		uint32_t Num() const { return Ready.Num(); }
+	};
+
+	inline void WakeBinding::Notify() const
+	{
+		if (Child)
+		{
+			Child->Signal();
+		}
+		Queue->Push(Task);
+	}
+}
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <limits>
 #include <atomic>
 #include <thread>
 #include <variant>
 #include <array>
+#include <vector>
 #include <coroutine>
 #include "LockFreeQueue.h"
 
@@ -102,12 +104,13 @@ class TaskExecutor
 	std::atomic<TaskId> short_head;
 	std::atomic<TaskId> long_head;
 
-	std::array<std::thread, 8> Workers;
+	std::vector<std::thread> Workers;
 	std::atomic_flag bStopRequest;
 
 public:
 
-	TaskExecutor()
+	// See ThreadPoolConfig in Async.h for pinning and NUMA-local workers.
+	explicit TaskExecutor(uint32 NumWorkers = std::max(1u, std::thread::hardware_concurrency()))
 	{
 		auto WorkerLoop = [this]()
 		{
@@ -135,9 +138,9 @@ public:
 			}
 		};
 
-		for (auto& Thread : Workers)
+		for (uint32 Index = 0; Index < NumWorkers; Index++)
 		{
-			Thread = std::thread(WorkerLoop);
+			Workers.emplace_back(WorkerLoop);
 		}
 	}
 
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "UniqueTask.h"
+#include "ReadyQueue.h"
+#include "TimerWheel.h"
+
+namespace Coroutine
+{
+	// Owns and drives tasks on a single thread.
+	// Tasks, that can make progress, are kept in a dense array and resumed in order on each Tick.
+	// Tasks waiting for an event (Async, OneShot, Delay) are parked in the waiting set and cost nothing until the event pushes them back.
+	// Finished tasks are destroyed, their results are discarded.
+	// A parked task, whose token is cancelled, is resumed with the next Tick, so it finishes without waiting for its event.
+	class Scheduler
+	{
+		std::vector<PromiseCore*> Ready;
+		std::vector<PromiseCore*> Resuming;
+		std::vector<PromiseCore*> Waiting;	// PromiseCore::OwnerIndex is the index in this array
+		std::vector<PromiseCore*> Destroyed;	// Since the last Tick, sorted
+		ReadyQueue Woken;
+		TimerWheel Timers;	// Current wheel while the tasks are resumed
+		uint32_t SeenCancels = CancellationSource::NumCancels();
+
+		Scheduler(const Scheduler&) = delete;
+		Scheduler& operator=(const Scheduler&) = delete;
+
+		void Park(PromiseCore* Core)
+		{
+			Core->SetOwnerIndex(static_cast<uint32_t>(Waiting.size()));
+			Waiting.push_back(Core);
+		}
+
+		// A task waiting for several events (WhenAll) can be woken more than once.
+		bool Unpark(PromiseCore* Core)
+		{
+			const uint32_t Index = Core->GetOwnerIndex();
+			if (Index >= Waiting.size() || Waiting[Index] != Core)
+			{
+				return false;
+			}
+			Waiting[Index] = Waiting.back();
+			Waiting[Index]->SetOwnerIndex(Index);
+			Waiting.pop_back();
+			return true;
+		}
+
+		// Parked tasks are checked only after some source was cancelled
+		void UnparkCancelled()
+		{
+			const uint32_t NumCancels = CancellationSource::NumCancels();
+			if (NumCancels == SeenCancels)
+			{
+				return;
+			}
+			SeenCancels = NumCancels;
+			// Unpark moves the last task to the index, it was already checked
+			for (uint32_t Index = static_cast<uint32_t>(Waiting.size()); Index--;)
+			{
+				PromiseCore* Core = Waiting[Index];
+				if (Core->IsCancelPending() && Unpark(Core))
+				{
+					Ready.push_back(Core);
+				}
+			}
+		}
+
+		static void Destroy(PromiseCore* Core)
+		{
+			Core->GetCoroutine().destroy();
+		}
+
+	public:
+		Scheduler() = default;
+
+		// Owned tasks are destroyed. Event sources of a parked task finish their wake-up before its destruction returns,
+		// so they don't touch the scheduler afterwards.
+		~Scheduler()
+		{
+			for (PromiseCore* Core : Ready)
+			{
+				Destroy(Core);
+			}
+			for (PromiseCore* Core : Waiting)
+			{
+				Destroy(Core);
+			}
+		}
+
+		// Takes the ownership of the task. It starts with the next Tick.
+		template <typename Return, typename Yield>
+		void Spawn(UniqueTask<Return, Yield>&& Task)
+		{
+			PromiseCore* Core = Task.GetCore();
+			if (!Core)
+			{
+				return;
+			}
+			if (Core->Status() != EStatus::Suspended)
+			{
+				Task.Reset();
+				return;
+			}
+			Task.Release();
+			Woken.Bind(*Core);
+			Ready.push_back(Core);
+		}
+
+		// Resumes each ready task once. Returns number of resumed tasks.
+		uint32_t Tick()
+		{
+			// Event sources of a destroyed task (e.g. cancelled by WhenAny) finish their wake-up before the destruction returns.
+			// Such stale wake-ups are already in the queue, the pointers must not be dereferenced.
+			std::sort(Destroyed.begin(), Destroyed.end());
+			if (Timers.Num())
+			{
+				Timers.Advance(TimerWheel::Clock::now());
+			}
+			while (std::optional<PromiseCore*> Core = Woken.Pop())
+			{
+				if (!std::binary_search(Destroyed.begin(), Destroyed.end(), *Core) && Unpark(*Core))
+				{
+					Ready.push_back(*Core);
+				}
+			}
+			Destroyed.clear();
+			UnparkCancelled();
+
+			TimerWheel::Scope TimerScope(Timers);
+			Resuming.swap(Ready);
+			for (PromiseCore* Core : Resuming)
+			{
+				if (Core->ResumeBound())
+				{
+					Ready.push_back(Core);
+				}
+				else if (Core->Status() == EStatus::Suspended)
+				{
+					Park(Core);
+				}
+				else
+				{
+					Destroy(Core);
+					Destroyed.push_back(Core);
+				}
+			}
+			const uint32_t Resumed = static_cast<uint32_t>(Resuming.size());
+			Resuming.clear();
+			return Resumed;
+		}
+
+		// Number of owned tasks
+		uint32_t Num() const { return static_cast<uint32_t>(Ready.size() + Waiting.size()); }
+		uint32_t NumReady() const { return static_cast<uint32_t>(Ready.size()); }
+		uint32_t NumWaiting() const { return static_cast<uint32_t>(Waiting.size()); }
+	};
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// CPUs are numbered from 0. On Windows a CPU is Group * 64 + its index in the processor group.
+namespace MultiThread
+{
+	inline uint32_t GetNumCpus()
+	{
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// 1 on a machine without NUMA
+	inline uint32_t GetNumNumaNodes()
+	{
+#if defined(_WIN32)
+		ULONG HighestNode = 0;
+		return GetNumaHighestNodeNumber(&HighestNode) ? static_cast<uint32_t>(HighestNode) + 1 : 1;
+#elif defined(__linux__)
+		uint32_t Num = 0;
+		while (FILE* File = std::fopen(("/sys/devices/system/node/node" + std::to_string(Num) + "/cpulist").c_str(), "r"))
+		{
+			std::fclose(File);
+			Num++;
+		}
+		return std::max(1u, Num);
+#else
+		return 1;
+#endif
+	}
+
+	// All CPUs, when the node is unknown
+	inline std::vector<uint32_t> GetNumaNodeCpus(uint32_t Node)
+	{
+		std::vector<uint32_t> Cpus;
+#if defined(_WIN32)
+		GROUP_AFFINITY Affinity = {};
+		if (GetNumaNodeProcessorMaskEx(static_cast<USHORT>(Node), &Affinity))
+		{
+			for (uint32_t Bit = 0; Bit < 64; Bit++)
+			{
+				if (Affinity.Mask & (KAFFINITY(1) << Bit))
+				{
+					Cpus.push_back(Affinity.Group * 64 + Bit);
+				}
+			}
+		}
+#elif defined(__linux__)
+		// Ranges, like "0-7,16-23"
+		if (FILE* File = std::fopen(("/sys/devices/system/node/node" + std::to_string(Node) + "/cpulist").c_str(), "r"))
+		{
+			unsigned First = 0;
+			while (std::fscanf(File, "%u", &First) == 1)
+			{
+				unsigned Last = First;
+				int Separator = std::fgetc(File);
+				if (Separator == '-')
+				{
+					if (std::fscanf(File, "%u", &Last) != 1)
+						break;
+					Separator = std::fgetc(File);
+				}
+				for (unsigned Cpu = First; Cpu <= Last; Cpu++)
+				{
+					Cpus.push_back(Cpu);
+				}
+				if (Separator != ',')
+					break;
+			}
+			std::fclose(File);
+		}
+#endif
+		if (Cpus.empty())
+		{
+			for (uint32_t Cpu = 0; Cpu < GetNumCpus(); Cpu++)
+			{
+				Cpus.push_back(Cpu);
+			}
+		}
+		return Cpus;
+	}
+
+	// The calling thread runs only on the given CPUs. On Windows the CPUs have to be in one processor group (the group of the first one is used).
+	// Returns false, when it's not supported or the CPUs are invalid.
+	inline bool SetCurrentThreadAffinity(const std::vector<uint32_t>& Cpus)
+	{
+		if (Cpus.empty())
+			return false;
+#if defined(_WIN32)
+		GROUP_AFFINITY Affinity = {};
+		Affinity.Group = static_cast<WORD>(Cpus[0] / 64);
+		for (uint32_t Cpu : Cpus)
+		{
+			if (Cpu / 64 == Affinity.Group)
+			{
+				Affinity.Mask |= KAFFINITY(1) << (Cpu % 64);
+			}
+		}
+		return !!SetThreadGroupAffinity(GetCurrentThread(), &Affinity, nullptr);
+#elif defined(__linux__)
+		cpu_set_t Set;
+		CPU_ZERO(&Set);
+		for (uint32_t Cpu : Cpus)
+		{
+			if (Cpu < CPU_SETSIZE)
+			{
+				CPU_SET(Cpu, &Set);
+			}
+		}
+		return !pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+#else
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+
+#include "Promise.h"
+#include "ReadyQueue.h"
+
+namespace Coroutine
+{
+	class TimerWheel;
+
+	// Intrusive entry of the wheel. Lives in the awaiter, so no timer allocates.
+	struct TimerNode
+	{
+		TimerNode* Prev = nullptr;
+		TimerNode* Next = nullptr;
+		TimerWheel* Wheel = nullptr;	// Set while linked
+		uint64_t Expiry = 0;			// Tick
+		WakeBinding Wake;				// Pushed when expired
+		uint8_t Level = 0;
+		uint8_t Slot = 0;
+		bool bExpired = false;
+	};
+
+	// Hierarchical timer wheel, owned and advanced by one thread.
+	// Levels of 64 slots, each level is 64 times coarser. Timers are moved to a finer level when their slot is reached.
+	// Adding and removing a timer is O(1), Advance costs O(expired + cascaded), empty slots and idle time are skipped using bit masks.
+	// Expired timers push their bound tasks to the ReadyQueue, so sleeping tasks are not polled.
+	class TimerWheel
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+	private:
+		static constexpr uint32_t kSlotBits = 6;
+		static constexpr uint32_t kSlots = 1 << kSlotBits;
+		static constexpr uint32_t kLevels = 5;	// 2^30 ticks, timers further away are parked in the last slot and reinserted
+		static constexpr uint64_t kMaxDelta = (uint64_t{ 1 } << (kSlotBits * kLevels)) - 1;
+
+		struct Level
+		{
+			std::array<TimerNode*, kSlots> Slots{};
+			uint64_t Occupied = 0;
+		};
+
+		std::array<Level, kLevels> Levels;
+		const Clock::time_point Start;
+		const Clock::duration Resolution;
+		uint64_t Current = 0;	// All ticks up to this one are processed
+		uint32_t Count = 0;
+
+		static inline thread_local TimerWheel* CurrentWheel = nullptr;
+
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+
+		// Timers expiring before MinTick are expired at MinTick.
+		void Insert(TimerNode& Node, uint64_t MinTick)
+		{
+			const uint64_t Expiry = std::max(Node.Expiry, MinTick);
+			const uint64_t Delta = std::min(Expiry - Current, kMaxDelta);
+			uint32_t LevelIndex = 0;
+			while (LevelIndex + 1 < kLevels && Delta >= (uint64_t{ 1 } << (kSlotBits * (LevelIndex + 1))))
+			{
+				LevelIndex++;
+			}
+			const uint32_t SlotIndex = static_cast<uint32_t>(((Current + Delta) >> (kSlotBits * LevelIndex)) & (kSlots - 1));
+
+			Level& Target = Levels[LevelIndex];
+			Node.Level = static_cast<uint8_t>(LevelIndex);
+			Node.Slot = static_cast<uint8_t>(SlotIndex);
+			Node.Prev = nullptr;
+			Node.Next = Target.Slots[SlotIndex];
+			if (Node.Next)
+			{
+				Node.Next->Prev = &Node;
+			}
+			Target.Slots[SlotIndex] = &Node;
+			Target.Occupied |= uint64_t{ 1 } << SlotIndex;
+		}
+
+		void Unlink(TimerNode& Node)
+		{
+			Level& Owner = Levels[Node.Level];
+			(Node.Prev ? Node.Prev->Next : Owner.Slots[Node.Slot]) = Node.Next;
+			if (Node.Next)
+			{
+				Node.Next->Prev = Node.Prev;
+			}
+			if (!Owner.Slots[Node.Slot])
+			{
+				Owner.Occupied &= ~(uint64_t{ 1 } << Node.Slot);
+			}
+			Node.Prev = Node.Next = nullptr;
+		}
+
+		TimerNode* DetachSlot(uint32_t LevelIndex, uint32_t SlotIndex)
+		{
+			Level& Owner = Levels[LevelIndex];
+			TimerNode* List = Owner.Slots[SlotIndex];
+			Owner.Slots[SlotIndex] = nullptr;
+			Owner.Occupied &= ~(uint64_t{ 1 } << SlotIndex);
+			return List;
+		}
+
+		// Current entered a new slot of level 1. Moves timers of the entered slots down.
+		void Cascade()
+		{
+			for (uint32_t LevelIndex = 1; LevelIndex < kLevels; LevelIndex++)
+			{
+				const uint32_t SlotIndex = static_cast<uint32_t>((Current >> (kSlotBits * LevelIndex)) & (kSlots - 1));
+				TimerNode* List = DetachSlot(LevelIndex, SlotIndex);
+				while (List)
+				{
+					TimerNode* Next = List->Next;
+					Insert(*List, Current);
+					List = Next;
+				}
+				if (SlotIndex)
+				{
+					break;
+				}
+			}
+		}
+
+		uint32_t Expire(uint32_t SlotIndex)
+		{
+			uint32_t Expired = 0;
+			TimerNode* List = DetachSlot(0, SlotIndex);
+			while (List)
+			{
+				TimerNode* Next = List->Next;
+				List->Prev = List->Next = nullptr;
+				List->Wheel = nullptr;
+				List->bExpired = true;
+				if (List->Wake)
+				{
+					List->Wake.Notify();
+				}
+				Count--;
+				Expired++;
+				List = Next;
+			}
+			return Expired;
+		}
+
+		// First tick after Current, that enters an occupied slot of any level. Ticks between are skipped.
+		uint64_t NextEventTick() const
+		{
+			uint64_t Next = UINT64_MAX;
+			for (uint32_t LevelIndex = 0; LevelIndex < kLevels; LevelIndex++)
+			{
+				const uint32_t Shift = kSlotBits * LevelIndex;
+				const uint64_t Round = Current >> Shift;
+				const uint64_t Ahead = std::rotr(Levels[LevelIndex].Occupied, static_cast<int>((Round + 1) & (kSlots - 1)));
+				if (Ahead)
+				{
+					Next = std::min(Next, (Round + std::countr_zero(Ahead) + 1) << Shift);
+				}
+			}
+			return Next;
+		}
+
+		uint64_t ToTick(Clock::time_point Time, bool bRoundUp) const
+		{
+			if (Time <= Start)
+			{
+				return 0;
+			}
+			const Clock::duration Elapsed = Time - Start;
+			const uint64_t Ticks = static_cast<uint64_t>(Elapsed / Resolution);
+			return (bRoundUp && Elapsed % Resolution != Clock::duration::zero()) ? Ticks + 1 : Ticks;
+		}
+
+	public:
+		explicit TimerWheel(Clock::duration InResolution = std::chrono::milliseconds(1), Clock::time_point InStart = Clock::now())
+			: Start(InStart)
+			, Resolution(InResolution)
+		{
+			assert(Resolution > Clock::duration::zero());
+		}
+
+		// Awaiters remove themselves on destruction, destroy the waiting tasks first.
+		~TimerWheel()
+		{
+			assert(!Count);
+		}
+
+		// The timer never expires before the deadline, it can expire up to one Resolution later.
+		void Add(TimerNode& Node, Clock::time_point Deadline)
+		{
+			assert(!Node.Wheel);
+			Node.Wheel = this;
+			Node.bExpired = false;
+			Node.Expiry = ToTick(Deadline, true);
+			Insert(Node, Current + 1);
+			Count++;
+		}
+
+		void Remove(TimerNode& Node)
+		{
+			assert(Node.Wheel == this);
+			Unlink(Node);
+			Node.Wheel = nullptr;
+			Count--;
+		}
+
+		// Expires timers up to Now. Returns number of expired timers.
+		uint32_t Advance(Clock::time_point Now)
+		{
+			const uint64_t Target = ToTick(Now, false);
+			if (!Count)
+			{
+				Current = std::max(Current, Target);
+				return 0;
+			}
+
+			uint32_t Expired = 0;
+			while (Current < Target)
+			{
+				Current = std::min(NextEventTick(), Target);
+				const uint32_t SlotIndex = static_cast<uint32_t>(Current & (kSlots - 1));
+				if (!SlotIndex)
+				{
+					Cascade();
+				}
+				Expired += Expire(SlotIndex);
+			}
+			return Expired;
+		}
+
+		// Number of pending timers
+		uint32_t Num() const { return Count; }
+
+		// Wheel used by Delay and Until awaited on this thread. Without it, the deadline is polled.
+		static TimerWheel* GetCurrent() { return CurrentWheel; }
+
+		class Scope
+		{
+			TimerWheel* Previous;
+
+		public:
+			explicit Scope(TimerWheel& Wheel) : Previous(std::exchange(CurrentWheel, &Wheel)) {}
+			~Scope() { CurrentWheel = Previous; }
+		};
+	};
+
+	// Suspends until the deadline. Registered in the current TimerWheel, a bound task is parked until the timer expires.
+	class DelayAwaiter : public VeryBaseAwaiter
+	{
+		TimerWheel::Clock::time_point Deadline;
+		TimerNode Node;
+
+	public:
+		explicit DelayAwaiter(TimerWheel::Clock::time_point InDeadline) : Deadline(InDeadline) {}
+		DelayAwaiter(DelayAwaiter&& Other) : Deadline(Other.Deadline)
+		{
+			assert(!Other.Node.Wheel);
+		}
+		DelayAwaiter(const DelayAwaiter&) = delete;
+		DelayAwaiter& operator=(const DelayAwaiter&) = delete;
+
+		~DelayAwaiter()
+		{
+			if (Node.Wheel)
+			{
+				Node.Wheel->Remove(Node);
+			}
+		}
+
+		bool await_ready() const noexcept { return TimerWheel::Clock::now() >= Deadline; }
+
+		template <typename PromiseType>
+		bool await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept
+		{
+			assert(Handle);
+			PromiseCore& Core = Handle.promise();
+			TimerWheel* Wheel = TimerWheel::GetCurrent();
+			if (!Wheel)
+			{
+				Core.SetFunc([this]() -> bool { return TimerWheel::Clock::now() >= Deadline; });
+				return true;
+			}
+			Node.Wake = Core.WaitForEvent();
+			Wheel->Add(Node, Deadline);
+			Core.SetFunc([this]() -> bool { return Node.bExpired; });
+			return true;
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	//	co_await Delay(std::chrono::milliseconds(100));
+	template <typename Rep, typename Period>
+	DelayAwaiter Delay(std::chrono::duration<Rep, Period> Duration)
+	{
+		return DelayAwaiter(TimerWheel::Clock::now() + std::chrono::duration_cast<TimerWheel::Clock::duration>(Duration));
+	}
+
+	inline DelayAwaiter Until(TimerWheel::Clock::time_point Deadline)
+	{
+		return DelayAwaiter(Deadline);
+	}
+}
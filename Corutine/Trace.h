@@ -0,0 +1,172 @@
+#pragma once
+
+// Compile-time switch of the instrumentation. With 0 (default) nothing is recorded and the promises don't grow.
+#ifndef COROUTINE_TRACE
+#define COROUTINE_TRACE 0
+#endif
+
+#if COROUTINE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <source_location>
+#include <vector>
+
+namespace Coroutine::Trace
+{
+	enum class EKind : uint8_t
+	{
+		Resume,	// A frame ran on this thread
+		Async,	// A frame requested an Async call
+		Job		// ThreadPool worker executed a call
+	};
+
+	struct Event
+	{
+		const char* Name = nullptr;
+		const char* File = nullptr;
+		uint32_t Line = 0;
+		EKind Kind = EKind::Resume;
+		const char* Reason = nullptr;	// Why the frame suspended, after a Resume
+		int64_t BeginNs = 0;
+		int64_t EndNs = 0;
+		int64_t SuspendedNs = -1;		// Since the previous Resume of the frame, -1 for the first one
+		const void* Frame = nullptr;
+	};
+
+	inline int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Ring of the latest events of one thread. Only the owning thread writes, without locks.
+	// The ring outlives the thread, so events of finished workers can be dumped.
+	class ThreadBuffer
+	{
+		static constexpr uint32_t kCapacity = 1 << 16;
+
+		std::unique_ptr<Event[]> Events = std::make_unique<Event[]>(kCapacity);
+		std::atomic<uint64_t> Head = 0;
+		const uint32_t ThreadId;
+
+		friend class Registry;
+
+	public:
+		explicit ThreadBuffer(uint32_t InThreadId) : ThreadId(InThreadId) {}
+
+		void Write(const Event& InEvent)
+		{
+			const uint64_t Index = Head.load(std::memory_order_relaxed);
+			Events[Index & (kCapacity - 1)] = InEvent;
+			Head.store(Index + 1, std::memory_order_release);
+		}
+	};
+
+	class Registry
+	{
+		std::mutex Lock;	// Only registration of a thread and dumping
+		std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+
+		static void WriteString(std::ostream& Out, const char* Text)
+		{
+			Out << '"';
+			for (const char* It = Text ? Text : ""; *It; It++)
+			{
+				if (*It == '"' || *It == '\\')
+				{
+					Out << '\\';
+				}
+				Out << *It;
+			}
+			Out << '"';
+		}
+
+		static const char* KindName(EKind Kind)
+		{
+			switch (Kind)
+			{
+			case EKind::Resume: return "resume";
+			case EKind::Async: return "async";
+			case EKind::Job: return "job";
+			}
+			return "";
+		}
+
+	public:
+		static Registry& Get()
+		{
+			static Registry Instance;
+			return Instance;
+		}
+
+		ThreadBuffer& Register()
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			Buffers.push_back(std::make_unique<ThreadBuffer>(static_cast<uint32_t>(Buffers.size())));
+			return *Buffers.back();
+		}
+
+		// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+		// Dump when the traced threads are idle, the newest events of a running thread may be torn.
+		void WriteChromeJson(std::ostream& Out)
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			Out << "{\"traceEvents\":[";
+			bool bFirst = true;
+			for (const std::unique_ptr<ThreadBuffer>& Buffer : Buffers)
+			{
+				const uint64_t End = Buffer->Head.load(std::memory_order_acquire);
+				const uint64_t Begin = End > ThreadBuffer::kCapacity ? End - ThreadBuffer::kCapacity : 0;
+				for (uint64_t Index = Begin; Index < End; Index++)
+				{
+					const Event& Entry = Buffer->Events[Index & (ThreadBuffer::kCapacity - 1)];
+					Out << (bFirst ? "\n" : ",\n") << "{\"name\":";
+					WriteString(Out, Entry.Name);
+					Out << ",\"cat\":\"" << KindName(Entry.Kind) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << Buffer->ThreadId
+						<< ",\"ts\":" << Entry.BeginNs / 1000.0 << ",\"dur\":" << (Entry.EndNs - Entry.BeginNs) / 1000.0
+						<< ",\"args\":{\"frame\":\"" << Entry.Frame << "\",\"file\":";
+					WriteString(Out, Entry.File);
+					Out << ",\"line\":" << Entry.Line;
+					if (Entry.Reason)
+					{
+						Out << ",\"suspend\":\"" << Entry.Reason << "\"";
+					}
+					if (Entry.SuspendedNs >= 0)
+					{
+						Out << ",\"suspended_us\":" << Entry.SuspendedNs / 1000.0;
+					}
+					Out << "}}";
+					bFirst = false;
+				}
+			}
+			Out << "\n]}\n";
+		}
+
+		// Drops recorded events, the threads stay registered. Call it when the traced threads are idle.
+		void Clear()
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			for (const std::unique_ptr<ThreadBuffer>& Buffer : Buffers)
+			{
+				Buffer->Head.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	inline ThreadBuffer& GetThreadBuffer()
+	{
+		thread_local ThreadBuffer& Buffer = Registry::Get().Register();
+		return Buffer;
+	}
+
+	inline void Write(const Event& InEvent)
+	{
+		GetThreadBuffer().Write(InEvent);
+	}
+}
+
+#endif
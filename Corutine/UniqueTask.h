@@ -19,6 +19,8 @@ namespace Coroutine
 		using Super::Handle;
 
 		friend PromiseBase<Return, Yield, PromiseType, UniqueTask>;
+
+	protected:
 		UniqueTask(HandleType InHandle) : Super(InHandle) {}
 
 	public:
@@ -33,6 +35,14 @@ namespace Coroutine
 			}
 		}
 
+		// Detaches the coroutine without destroying it. The caller takes the ownership.
+		HandleType Release()
+		{
+			HandleType Result = Handle;
+			Handle = nullptr;
+			return Result;
+		}
+
 		UniqueTask() = default;
 		UniqueTask(UniqueTask&& Other) : Super(std::move(Other.Handle))
 		{
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <span>
+#include <tuple>
+#include <vector>
+#include <variant>
+#include <atomic>
+#include <bit>
+
+#include "Promise.h"
+
+namespace Coroutine
+{
+	template <typename TaskType>
+	using TaskResult = std::conditional_t<std::is_void_v<typename TaskType::ReturnType>,
+		std::monostate, std::optional<typename TaskType::ReturnType>>;
+
+	template <typename TaskType>
+	TaskResult<TaskType> ConsumeTaskResult(TaskType& Task)
+	{
+		if constexpr (std::is_void_v<typename TaskType::ReturnType>)
+		{
+			return {};
+		}
+		else
+		{
+			return Task.Consume();
+		}
+	}
+
+	// Awaiting frame of WhenAll/WhenAny. Children are resumed from its predicate.
+	// In a bound task each child reports its wake-ups to the list of the awaiter, so an update resumes only the woken children,
+	// plus the ones, that are polled (they didn't suspend for an event). Finished children are counted.
+	class MultiTaskAwaiterBase : public VeryBaseAwaiter
+	{
+		PromiseCore* Awaiting = nullptr;
+		std::atomic<ChildWake*> Woken = nullptr;	// Children woken since the last update
+
+	protected:
+		MultiTaskAwaiterBase() = default;
+		// Moved only before it's awaited
+		MultiTaskAwaiterBase(MultiTaskAwaiterBase&& Other) noexcept { assert(!Other.Awaiting); }
+
+		bool IsBound() const { return Awaiting && Awaiting->GetWake(); }
+
+		template <typename TaskType>
+		void AttachChild(TaskType& Task, uint32_t Index)
+		{
+			if (PromiseCore* Core = Task.GetCore())
+			{
+				Core->InheritFrom(*Awaiting);
+				if (IsBound())
+				{
+					Core->AttachChildWake(Woken, Index);
+				}
+			}
+		}
+
+		template <typename TaskType>
+		void DetachChild(TaskType& Task)
+		{
+			if (PromiseCore* Core = Task.GetCore(); Core && IsBound())
+			{
+				Core->DetachChildWake();
+			}
+		}
+
+		// Returns true when the task is finished (or disconnected).
+		// bOutPolled is set, when the task suspended without waiting for an event.
+		template <typename TaskType>
+		bool ResumeChild(TaskType& Task, bool& bOutPolled)
+		{
+			if (Task.Status() != EStatus::Suspended)
+			{
+				return true;
+			}
+			Awaiting->TakeEventWait();
+			Task.Resume();
+			const EStatus Status = Task.Status();
+			assert(Status != EStatus::Resuming);
+			if (Status == EStatus::Suspended)
+			{
+				bOutPolled = !Awaiting->TakeEventWait();
+				return false;
+			}
+			return true;
+		}
+
+		// Indexes of the children woken by their events
+		template <typename Fn>
+		void ForEachWoken(Fn&& Visit)
+		{
+			for (ChildWake* Record = Woken.exchange(nullptr); Record;)
+			{
+				ChildWake* Next = Record->GetNext();
+				Visit(Record->Take());
+				Record = Next;
+			}
+		}
+
+		// Resumes children. Returns true when the awaiting frame can continue.
+		template <typename Derived>
+		bool Update(Derived& Self)
+		{
+			const bool bReady = Self.ResumeChildren();
+			if (!bReady && !Self.HasPolled())
+			{
+				// No child is polled, the frame waits for the events of its children.
+				Awaiting->WaitForEvent();
+			}
+			return bReady;
+		}
+
+		template <typename Derived, typename PromiseType>
+		bool Suspend(Derived& Self, std::coroutine_handle<PromiseType> Handle)
+		{
+			assert(Handle);
+			Awaiting = &Handle.promise();
+			Self.AttachChildren();
+			if (Update(Self))
+			{
+				return false;
+			}
+			Awaiting->SetFunc([&Self]() -> bool { return Self.Update(Self); });
+			return true;
+		}
+	};
+
+	template <bool bAny, typename... TaskTypes>
+	class MultiTaskAwaiter : public MultiTaskAwaiterBase
+	{
+		friend MultiTaskAwaiterBase;
+		static constexpr uint32_t kNum = sizeof...(TaskTypes);
+		std::tuple<TaskTypes...> Tasks;
+		uint32_t Remaining = kNum;
+		std::size_t FirstDone = kNum;
+		uint64_t DoneMask = 0;
+		uint64_t PolledMask = 0;
+		bool bStarted = false;
+
+		static_assert(kNum <= 64, "Too many tasks, use the std::span version.");
+
+		void AttachChildren()
+		{
+			[this]<std::size_t... Index>(std::index_sequence<Index...>)
+			{
+				(AttachChild(std::get<Index>(Tasks), Index), ...);
+			}(std::index_sequence_for<TaskTypes...>{});
+		}
+
+		template <typename TaskType>
+		void ResumeOne(TaskType& Task, uint32_t Index)
+		{
+			const uint64_t Bit = uint64_t{ 1 } << Index;
+			if ((DoneMask & Bit) || (bAny && Remaining < kNum))
+			{
+				return;
+			}
+			bool bPolled = false;
+			if (ResumeChild(Task, bPolled))
+			{
+				DoneMask |= Bit;
+				Remaining--;
+				FirstDone = (FirstDone < kNum) ? FirstDone : Index;
+			}
+			PolledMask = bPolled ? (PolledMask | Bit) : (PolledMask & ~Bit);
+		}
+
+		template <std::size_t... Index>
+		void ResumeAt(uint32_t At, std::index_sequence<Index...>)
+		{
+			((At == Index ? ResumeOne(std::get<Index>(Tasks), Index) : void()), ...);
+		}
+
+		bool ResumeChildren()
+		{
+			if (!bStarted)
+			{
+				bStarted = true;
+				std::apply([this](TaskTypes&... Task)
+					{
+						uint32_t Index = 0;
+						(ResumeOne(Task, Index++), ...);
+					}, Tasks);
+			}
+			else
+			{
+				// Polled children are resumed once, even when they were woken too
+				uint64_t Polled = PolledMask;
+				ForEachWoken([&](uint32_t Index)
+					{
+						if (!(Polled & (uint64_t{ 1 } << Index)))
+						{
+							ResumeAt(Index, std::index_sequence_for<TaskTypes...>{});
+						}
+					});
+				for (; Polled; Polled &= Polled - 1)
+				{
+					ResumeAt(static_cast<uint32_t>(std::countr_zero(Polled)), std::index_sequence_for<TaskTypes...>{});
+				}
+			}
+			return bAny ? (Remaining < kNum || !Remaining) : !Remaining;
+		}
+
+		bool HasPolled() const { return !!PolledMask; }
+
+		std::tuple<TaskResult<TaskTypes>...> ConsumeAll()
+		{
+			return std::apply([](TaskTypes&... Task)
+				{
+					return std::tuple<TaskResult<TaskTypes>...>(ConsumeTaskResult(Task)...);
+				}, Tasks);
+		}
+
+	public:
+		MultiTaskAwaiter(TaskTypes&&... InTasks) : Tasks(std::move(InTasks)...) {}
+		MultiTaskAwaiter(MultiTaskAwaiter&&) = default;
+
+		// The children are detached before they are destroyed
+		~MultiTaskAwaiter()
+		{
+			std::apply([this](TaskTypes&... Task) { (DetachChild(Task), ...); }, Tasks);
+		}
+
+		bool await_ready() noexcept { return false; }
+
+		template <typename PromiseType>
+		bool await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept
+		{
+			return Suspend(*this, Handle);
+		}
+
+		auto await_resume()
+		{
+			if constexpr (bAny)
+			{
+				return std::pair<std::size_t, std::tuple<TaskResult<TaskTypes>...>>(FirstDone, ConsumeAll());
+			}
+			else
+			{
+				return ConsumeAll();
+			}
+		}
+	};
+
+	template <bool bAny, typename TaskType>
+	class MultiTaskRangeAwaiter : public MultiTaskAwaiterBase
+	{
+		friend MultiTaskAwaiterBase;
+
+		enum class EChild : uint8_t
+		{
+			Waiting,	// For an event, resumed when woken
+			Polled,
+			Done
+		};
+
+		std::span<TaskType> Tasks;
+		std::vector<EChild> Children;
+		std::vector<uint32_t> Polled;	// Indexes of the polled children
+		std::vector<uint32_t> Polling;
+		uint32_t Remaining;
+		std::size_t FirstDone;
+		bool bStarted = false;
+
+		void AttachChildren()
+		{
+			Children.resize(Tasks.size(), EChild::Waiting);
+			for (uint32_t Index = 0; Index < Tasks.size(); Index++)
+			{
+				AttachChild(Tasks[Index], Index);
+			}
+		}
+
+		// Returns true when the awaiting frame can continue
+		bool ResumeAt(uint32_t Index)
+		{
+			bool bPolled = false;
+			if (ResumeChild(Tasks[Index], bPolled))
+			{
+				Children[Index] = EChild::Done;
+				Remaining--;
+				if constexpr (bAny)
+				{
+					FirstDone = Index;
+					return true;
+				}
+				return !Remaining;
+			}
+			Children[Index] = bPolled ? EChild::Polled : EChild::Waiting;
+			if (bPolled)
+			{
+				Polled.push_back(Index);
+			}
+			return false;
+		}
+
+		bool ResumeChildren()
+		{
+			if (!bStarted)
+			{
+				bStarted = true;
+				for (uint32_t Index = 0; Index < Tasks.size(); Index++)
+				{
+					if (ResumeAt(Index))
+					{
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// Polled children are resumed once, even when they were woken too
+			Polling.swap(Polled);
+			Polled.clear();
+			bool bReady = false;
+			ForEachWoken([&](uint32_t Index)
+				{
+					if (!bReady && Children[Index] == EChild::Waiting)
+					{
+						bReady = ResumeAt(Index);
+					}
+				});
+			for (std::size_t It = 0; It < Polling.size() && !bReady; It++)
+			{
+				bReady = ResumeAt(Polling[It]);
+			}
+			Polling.clear();
+			return bReady;
+		}
+
+		bool HasPolled() const { return !Polled.empty(); }
+
+	public:
+		MultiTaskRangeAwaiter(std::span<TaskType> InTasks)
+			: Tasks(InTasks), Remaining(static_cast<uint32_t>(InTasks.size())), FirstDone(InTasks.size()) {}
+		MultiTaskRangeAwaiter(MultiTaskRangeAwaiter&&) = default;
+
+		// The tasks stay with the caller, later wake-ups don't reach the awaiter
+		~MultiTaskRangeAwaiter()
+		{
+			if (!Children.empty())
+			{
+				for (TaskType& Task : Tasks)
+				{
+					DetachChild(Task);
+				}
+			}
+		}
+
+		bool await_ready() noexcept { return Tasks.empty(); }
+
+		template <typename PromiseType>
+		bool await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept
+		{
+			return Suspend(*this, Handle);
+		}
+
+		auto await_resume()
+		{
+			if constexpr (bAny)
+			{
+				using ResultType = std::pair<std::size_t, TaskResult<TaskType>>;
+				return (FirstDone < Tasks.size()) ? ResultType(FirstDone, ConsumeTaskResult(Tasks[FirstDone])) : ResultType(FirstDone, {});
+			}
+			else
+			{
+				std::vector<TaskResult<TaskType>> Results;
+				Results.reserve(Tasks.size());
+				for (TaskType& Task : Tasks)
+				{
+					Results.push_back(ConsumeTaskResult(Task));
+				}
+				return Results;
+			}
+		}
+	};
+
+	// Suspends once, until all the tasks are done. In a bound task only the children woken by their events (or polled ones) are resumed.
+	//	std::tuple<std::optional<int>, std::monostate> Results = co_await WhenAll(TaskA(), TaskB());
+	// The awaiter owns the tasks.
+	template <typename... TaskTypes, std::enable_if_t<(std::is_base_of_v<VeryBaseTask, std::decay_t<TaskTypes>> && ...), int> = 0>
+	auto WhenAll(TaskTypes&&... Tasks)
+	{
+		static_assert(!(std::is_lvalue_reference_v<TaskTypes> || ...), "The tasks are moved into the awaiter.");
+		return MultiTaskAwaiter<false, std::decay_t<TaskTypes>...>(std::move(Tasks)...);
+	}
+
+	// Suspends once, until any of the tasks is done. Unfinished tasks are destroyed with the awaiter.
+	// Returns index of the finished task and results (filled only for the finished tasks).
+	template <typename... TaskTypes, std::enable_if_t<(std::is_base_of_v<VeryBaseTask, std::decay_t<TaskTypes>> && ...), int> = 0>
+	auto WhenAny(TaskTypes&&... Tasks)
+	{
+		static_assert(!(std::is_lvalue_reference_v<TaskTypes> || ...), "The tasks are moved into the awaiter.");
+		return MultiTaskAwaiter<true, std::decay_t<TaskTypes>...>(std::move(Tasks)...);
+	}
+
+	// The tasks remain owned by the caller. Results are in the same order.
+	template <typename TaskType>
+	auto WhenAll(std::span<TaskType> Tasks)
+	{
+		return MultiTaskRangeAwaiter<false, TaskType>(Tasks);
+	}
+
+	// The tasks remain owned by the caller, unfinished ones are not touched.
+	// Returns index of the finished task and its result. Index is Tasks.size(), when there is no task.
+	template <typename TaskType>
+	auto WhenAny(std::span<TaskType> Tasks)
+	{
+		return MultiTaskRangeAwaiter<true, TaskType>(Tasks);
+	}
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include<atomic>
+#include<optional>
+#include<new>
+#include<assert.h>
+
+// Chase-Lev deque: the owner thread pushes and pops at the bottom (LIFO), other threads steal from the top (FIFO).
+// The owner doesn't use any CAS, unless it pops the last element. A thief claims the top position with a single CAS.
+// The ring holds indices of slots. Elements are constructed and consumed in place in the slots, so they don't have to be movable.
+// A slot is released by the thread consuming it, the owner reuses only released slots.
+// Bounded, nothing is allocated after the construction.
+template<typename T, uint32_t kCapacity>
+class WorkStealingDeque
+{
+	static_assert(kCapacity >= 2 && !(kCapacity & (kCapacity - 1)), "Capacity has to be a power of 2");
+
+	WorkStealingDeque(const WorkStealingDeque&) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+	WorkStealingDeque(const WorkStealingDeque&&) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque&&) = delete;
+
+	static constexpr uint32_t kCacheLine = 64;
+
+	struct Slot
+	{
+		std::aligned_storage_t<sizeof(T), alignof(T)> data;
+		std::atomic<bool> used = false;
+	};
+
+	Slot slots_[kCapacity];
+	std::atomic<uint32_t> ring_[kCapacity];	// Slot indices. Atomic, because a thief reads it before its claim is confirmed.
+	uint32_t next_slot_ = 0;	// Owner only
+	// Thieves don't share a cache line with the owner
+	alignas(kCacheLine) std::atomic<int64_t> top_ = 0;
+	alignas(kCacheLine) std::atomic<int64_t> bottom_ = 0;
+
+	template<typename Transform>
+	auto Consume(const uint32_t slot_index, Transform& func)
+	{
+		Slot& slot = slots_[slot_index];
+		T& transformable = *std::launder(reinterpret_cast<T*>(&slot.data));
+		std::optional<decltype(func(transformable))> result(func(transformable));
+		transformable.~T();
+		slot.used.store(false, std::memory_order_release);
+		return result;
+	}
+
+public:
+	WorkStealingDeque() = default;
+
+	~WorkStealingDeque()
+	{
+		while (Pop([](T&) { return true; })) {}
+	}
+
+	// Owner only. Returns false, when the deque is full. Arguments are not consumed in such case.
+	template<typename ...Args>
+	bool TryPush(Args&&... args)
+	{
+		const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+		const int64_t top = top_.load(std::memory_order_acquire);
+		if (bottom - top >= static_cast<int64_t>(kCapacity))
+			return false;
+
+		// Slots claimed from the ring may be still executed by thieves, find a released one
+		uint32_t slot_index = next_slot_;
+		for (uint32_t attempt = 0; slots_[slot_index].used.load(std::memory_order_acquire); attempt++)
+		{
+			if (attempt == kCapacity)
+				return false;
+			slot_index = (slot_index + 1) & (kCapacity - 1);
+		}
+		next_slot_ = (slot_index + 1) & (kCapacity - 1);
+
+		Slot& slot = slots_[slot_index];
+		::new(&slot.data) T(std::forward<Args>(args)...);
+		slot.used.store(true, std::memory_order_relaxed);
+		ring_[bottom & (kCapacity - 1)].store(slot_index, std::memory_order_relaxed);
+		bottom_.store(bottom + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Owner only. Takes the newest element. The element is destroyed after the func returns.
+	template<typename Transform>
+	auto Pop(Transform func) -> std::optional<decltype(func(*(T*)0))>
+	{
+		const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+		// Every store of the bottom is a release, so a thief reading any of them sees the elements written before
+		bottom_.store(bottom, std::memory_order_release);
+		// The decreased bottom is visible to thieves, before the top is read
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = top_.load(std::memory_order_relaxed);
+		if (top > bottom)
+		{
+			bottom_.store(bottom + 1, std::memory_order_release);
+			return {};
+		}
+
+		const uint32_t slot_index = ring_[bottom & (kCapacity - 1)].load(std::memory_order_relaxed);
+		if (top == bottom)
+		{
+			// The last element, race with thieves
+			const bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom_.store(bottom + 1, std::memory_order_release);
+			if (!won)
+				return {};
+		}
+		return Consume(slot_index, func);
+	}
+
+	// Any thread. Takes the oldest element. Returns nothing when the deque is empty, or when other thread took the element meanwhile.
+	template<typename Transform>
+	auto Steal(Transform func) -> std::optional<decltype(func(*(T*)0))>
+	{
+		int64_t top = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t bottom = bottom_.load(std::memory_order_acquire);
+		if (top >= bottom)
+			return {};
+
+		const uint32_t slot_index = ring_[top & (kCapacity - 1)].load(std::memory_order_relaxed);
+		if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return {};
+		return Consume(slot_index, func);
+	}
+
+	// Approximation, when other threads are active.
+	uint32_t Num() const
+	{
+		const int64_t top = top_.load(std::memory_order_relaxed);
+		const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+		return bottom > top ? static_cast<uint32_t>(bottom - top) : 0;
+	}
+
+	static constexpr uint32_t Capacity() { return kCapacity; }
+};
@@ -2,13 +2,30 @@
 #include "SharedTask.h"
 #include "BreakIf.h"
 #include "Async.h"
+#include "OneShot.h"
+#include "Scheduler.h"
+#include "WhenAll.h"
+#include "Generator.h"
+#include "AtomicSharedTask.h"
+#include "MPMCQueue.h"
+#include "WorkStealingDeque.h"
 
 #include <iostream>
 #include <chrono>
+#include <array>
+#include <sstream>
 
 using namespace Coroutine;
 using namespace std::literals;
 
+using PooledTask = UniqueTask<double>;
+using ChainedTask = UniqueTask<long>;
+namespace Coroutine
+{
+	template <> struct PooledFrames<PooledTask> : std::true_type {};
+	template <> struct ContinuationChain<ChainedTask> : std::true_type {};
+}
+
 const char* StatusToStr(EStatus status)
 {
 	switch (status)
@@ -114,6 +131,28 @@ void RunTest_20()
 	Expect(1, t.Consume().value_or(-1));
 }
 
+void RunTest_21()
+{
+	Log("TEST await inline predicate");
+	int Counter = 0;
+	const std::array<int, 8> Limits = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	UniqueTask<int> t = [&]() -> UniqueTask<int>
+	{
+		// Captures bigger than the small buffer of std::function
+		co_await[&Counter, Limits]() { return Counter >= Limits.back(); };
+		std::function<bool()> Predicate = [&]() { return Counter >= 10; };
+		co_await std::move(Predicate);
+		co_return Counter;
+	}();
+	while (t.Status() == EStatus::Suspended)
+	{
+		t.Resume();
+		Counter++;
+	}
+	Expect(11, Counter);
+	Expect(10, t.Consume().value_or(-1));
+}
+
 void RunTest_30()
 {
 	Log("TEST await task");
@@ -138,6 +177,261 @@ void RunTest_30()
 	Expect(EStatus::Done, t.Status());
 }
 
+template <typename TaskType>
+TaskType NestedTask(int Depth, const bool& bGate)
+{
+	if (!Depth)
+	{
+		co_await std::suspend_always{};
+		co_await [&]() { return bGate; };
+		co_return 1;
+	}
+	std::optional<typename TaskType::ReturnType> Inner = co_await NestedTask<TaskType>(Depth - 1, bGate);
+	co_await std::suspend_always{};
+	co_return Inner.value_or(-100) + 1;
+}
+
+template <typename TaskType>
+int CountResumes(int Depth)
+{
+	bool bGate = false;
+	TaskType t = NestedTask<TaskType>(Depth, bGate);
+	int Resumes = 0;
+	while (t.Status() == EStatus::Suspended)
+	{
+		t.Resume();
+		Resumes++;
+		bGate = Resumes >= 5;
+	}
+	Expect(Depth + 1, static_cast<int>(t.Consume().value_or(-1)));
+	return Resumes;
+}
+
+void RunTest_31()
+{
+	Log("TEST await task chain");
+
+	for (int Depth : { 0, 1, 8 })
+	{
+		Expect(CountResumes<UniqueTask<int>>(Depth), CountResumes<ChainedTask>(Depth));
+	}
+
+	ChainedTask t = []() -> ChainedTask
+	{
+		co_return 1;
+	}();
+	ChainedTask Outer = [&]() -> ChainedTask
+	{
+		const std::optional<long> Inner = co_await std::move(t);
+		co_return Inner.value_or(-1) + 1;
+	}();
+	Outer.Resume();
+	Expect(EStatus::Done, Outer.Status());
+	Expect(2, static_cast<int>(Outer.Consume().value_or(-1)));
+}
+
+UniqueTask<int> SuspendAndReturn(int Suspends, int Value)
+{
+	for (int s = 0; s < Suspends; s++)
+	{
+		co_await std::suspend_always{};
+	}
+	co_return Value;
+}
+
+// Pushes the waiting task when fired. Counts, how many times the waiting frame was resumed.
+struct CountedEvent : VeryBaseAwaiter
+{
+	WakeBinding Wake;
+	bool bFired = false;
+	int Polls = 0;
+
+	void Fire()
+	{
+		bFired = true;
+		if (Wake)
+		{
+			Wake.Notify();
+		}
+	}
+
+	bool await_ready() const noexcept { return bFired; }
+
+	template <typename PromiseType>
+	bool await_suspend(std::coroutine_handle<PromiseType> Handle) noexcept
+	{
+		Wake = Handle.promise().WaitForEvent();
+		Handle.promise().SetFunc([this]() -> bool
+		{
+			Polls++;
+			return bFired;
+		});
+		return true;
+	}
+
+	void await_resume() noexcept {}
+};
+
+void RunTest_32()
+{
+	Log("TEST WhenAll WhenAny");
+
+	UniqueTask<> t = []() -> UniqueTask<>
+	{
+		auto [A, B, C] = co_await WhenAll(SuspendAndReturn(2, 1), SuspendAndReturn(0, 2), []() -> UniqueTask<> { co_await std::suspend_always{}; }());
+		Expect(1, A.value_or(-1));
+		Expect(2, B.value_or(-1));
+
+		auto [First, Results] = co_await WhenAny(SuspendAndReturn(3, 1), SuspendAndReturn(1, 2));
+		Expect(1, static_cast<int>(First));
+		Expect(-1, std::get<0>(Results).value_or(-1));
+		Expect(2, std::get<1>(Results).value_or(-1));
+	}();
+	t.Resume();
+	Expect(EStatus::Suspended, t.Status());
+	t.Resume();
+	Expect(EStatus::Suspended, t.Status());
+	t.Resume(); // WhenAll done, WhenAny started
+	Expect(EStatus::Suspended, t.Status());
+	t.Resume();
+	Expect(EStatus::Done, t.Status());
+
+	// Range version, children wait for events
+	std::vector<std::pair<OneShot<int>, OneShotSender<int>>> Channels;
+	std::vector<UniqueTask<int>> Children;
+	Channels.reserve(50);
+	for (int i = 0; i < 50; i++)
+	{
+		Channels.push_back(MakeOneShot<int>());
+		Children.push_back([](OneShot<int>& Receiver) -> UniqueTask<int>
+		{
+			co_return (co_await Receiver).value_or(-1);
+		}(Channels.back().first));
+	}
+	int Sum = 0;
+	Scheduler Tasks;
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		std::vector<std::optional<int>> Results = co_await WhenAll(std::span(Children));
+		for (const std::optional<int>& Result : Results)
+		{
+			Sum += Result.value_or(-1000);
+		}
+	}());
+	Expect(1, static_cast<int>(Tasks.Tick()));
+	Expect(1, static_cast<int>(Tasks.NumWaiting()));
+	for (int i = 0; i < 50; i++)
+	{
+		Channels[i].second.Send(i);
+		Tasks.Tick();
+	}
+	Expect(0, static_cast<int>(Tasks.Num()));
+	Expect(49 * 50 / 2, Sum);
+
+	// Each completion resumes only the woken child
+	constexpr int kNum = 200;
+	std::vector<CountedEvent> Events(kNum);
+	std::vector<UniqueTask<int>> Waiters;
+	for (int i = 0; i < kNum; i++)
+	{
+		Waiters.push_back([](CountedEvent& Event, int Value) -> UniqueTask<int>
+		{
+			co_await Event;
+			co_return Value;
+		}(Events[i], i));
+	}
+	Sum = 0;
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		for (const std::optional<int>& Result : co_await WhenAll(std::span(Waiters)))
+		{
+			Sum += Result.value_or(-1000);
+		}
+	}());
+	Tasks.Tick();
+	for (int i = 0; i < kNum; i++)
+	{
+		Events[(i * 7) % kNum].Fire();
+		Tasks.Tick();
+	}
+	Expect(0, static_cast<int>(Tasks.Num()));
+	Expect((kNum - 1) * kNum / 2, Sum);
+	int Polls = 0;
+	for (const CountedEvent& Event : Events)
+	{
+		Polls += Event.Polls;
+	}
+	Expect(kNum, Polls);
+
+	// Polled children don't make the woken ones resumed again
+	std::array<CountedEvent, 3> AnyEvents;
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		auto Wait = [](CountedEvent& Event) -> UniqueTask<int> { co_await Event; co_return 1; };
+		auto [First, Results] = co_await WhenAny(Wait(AnyEvents[0]), Wait(AnyEvents[1]), SuspendAndReturn(1000, 3));
+		Expect(1, static_cast<int>(First));
+		Expect(1, std::get<1>(Results).value_or(-1));
+	}());
+	Tasks.Tick();
+	Tasks.Tick();
+	AnyEvents[1].Fire();
+	Tasks.Tick();
+	Expect(0, static_cast<int>(Tasks.Num()));
+	Expect(0, AnyEvents[0].Polls);
+	Expect(1, AnyEvents[1].Polls);
+
+	// Wake-ups of nested children reach the outer awaiter
+	std::array<CountedEvent, 4> NestedEvents;
+	int NestedSum = 0;
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		auto Pair = [](CountedEvent& A, CountedEvent& B) -> UniqueTask<int>
+		{
+			auto Wait = [](CountedEvent& Event) -> UniqueTask<int> { co_await Event; co_return 1; };
+			auto [ResultA, ResultB] = co_await WhenAll(Wait(A), Wait(B));
+			co_return ResultA.value_or(-1) + ResultB.value_or(-1);
+		};
+		auto [Left, Right] = co_await WhenAll(Pair(NestedEvents[0], NestedEvents[1]), Pair(NestedEvents[2], NestedEvents[3]));
+		NestedSum = Left.value_or(-1) + Right.value_or(-1);
+	}());
+	Tasks.Tick();
+	for (int i : { 2, 0, 3, 1 })
+	{
+		NestedEvents[i].Fire();
+		Tasks.Tick();
+	}
+	Expect(0, static_cast<int>(Tasks.Num()));
+	Expect(4, NestedSum);
+	for (const CountedEvent& Event : NestedEvents)
+	{
+		Expect(1, Event.Polls);
+	}
+
+	// Children woken from the workers
+	std::vector<UniqueTask<int>> Jobs;
+	for (int i = 0; i < kNum; i++)
+	{
+		Jobs.push_back([](int Value) -> UniqueTask<int>
+		{
+			co_return (co_await Async([Value]() { return Value; })).value_or(-1000);
+		}(i));
+	}
+	Sum = 0;
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		for (const std::optional<int>& Result : co_await WhenAll(std::span(Jobs)))
+		{
+			Sum += Result.value_or(-1000);
+		}
+	}());
+	while (Tasks.Num())
+	{
+		Tasks.Tick();
+		std::this_thread::yield();
+	}
+	Expect((kNum - 1) * kNum / 2, Sum);
+}
+
 void RunTest_40()
 {
 	Log("TEST CancelIf 1");
@@ -177,6 +471,106 @@ void RunTest_41()
 	Expect(1, t.Consume().value_or(-1));
 }
 
+template <typename TaskType>
+TaskType Forever()
+{
+	while (true)
+	{
+		co_await std::suspend_always{};
+	}
+	co_return 1;
+}
+
+template <typename TaskType>
+void TestCancelScope()
+{
+	CancellationSource Inner;
+	UniqueTask<int> t = [&]() -> UniqueTask<int>
+	{
+		TaskType Child = Forever<TaskType>();
+		Child.SetCancellation(Inner.GetToken());
+		const std::optional<typename TaskType::ReturnType> Result = co_await std::move(Child);
+		co_return Result ? -1 : 2;
+	}();
+	t.Resume();
+	t.Resume();
+	Expect(EStatus::Suspended, t.Status());
+	Inner.Cancel();
+	t.Resume();
+	Expect(EStatus::Done, t.Status());
+	Expect(2, t.Consume().value_or(-1));
+}
+
+void RunTest_42()
+{
+	Log("TEST cancellation token");
+
+	CancellationSource Source;
+	UniqueTask<int> t = []() -> UniqueTask<int>
+	{
+		co_return (co_await []() -> UniqueTask<int>
+		{
+			co_return (co_await Forever<ChainedTask>()).value_or(-1);
+		}()).value_or(-1);
+	}();
+	t.SetCancellation(Source.GetToken());
+	t.Resume();
+	t.Resume();
+	Expect(EStatus::Suspended, t.Status());
+	Source.Cancel();
+	t.Resume();
+	Expect(EStatus::Done, t.Status());
+	Expect(-1, t.Consume().value_or(-1));
+
+	// Only the awaited task is cancelled
+	TestCancelScope<UniqueTask<int>>();
+	TestCancelScope<ChainedTask>();
+
+	CancellationSource SchedulerSource;
+	Scheduler Tasks;
+	UniqueTask<int> Spawned = Forever<UniqueTask<int>>();
+	Spawned.SetCancellation(SchedulerSource.GetToken());
+	Tasks.Spawn(std::move(Spawned));
+	Tasks.Tick();
+	Expect(1, static_cast<int>(Tasks.Num()));
+	SchedulerSource.Cancel();
+	Tasks.Tick();
+	Expect(0, static_cast<int>(Tasks.Num()));
+
+	// Parked tasks are woken by the cancellation, their events never fire
+	CancellationSource ParkedSource;
+	std::pair<OneShot<int>, OneShotSender<int>> Channel = MakeOneShot<int>();
+	int Destroyed = 0;
+	auto OnDestroy = [&]() { Destroyed++; };
+	UniqueTask<> Receiver = [](OneShot<int>& Receiver, auto OnDestroy) -> UniqueTask<>
+	{
+		auto Guard = MakeFnGuard(OnDestroy);
+		co_await Receiver;
+	}(Channel.first, OnDestroy);
+	Receiver.SetCancellation(ParkedSource.GetToken());
+	UniqueTask<> Sleeper = [](auto OnDestroy) -> UniqueTask<>
+	{
+		auto Guard = MakeFnGuard(OnDestroy);
+		co_await Delay(1h);
+	}(OnDestroy);
+	Sleeper.SetCancellation(ParkedSource.GetToken());
+	Tasks.Spawn(std::move(Receiver));
+	Tasks.Spawn(std::move(Sleeper));
+	std::pair<OneShot<int>, OneShotSender<int>> Other = MakeOneShot<int>();
+	Tasks.Spawn([](OneShot<int>& Receiver) -> UniqueTask<> { co_await Receiver; }(Other.first));
+	Expect(3, static_cast<int>(Tasks.Tick()));
+	Expect(3, static_cast<int>(Tasks.NumWaiting()));
+	ParkedSource.Cancel();
+	Expect(2, static_cast<int>(Tasks.Tick()));
+	Expect(2, Destroyed);
+	// Not cancelled, stays parked
+	Expect(1, static_cast<int>(Tasks.NumWaiting()));
+	Expect(0, static_cast<int>(Tasks.Tick()));
+	Other.second.Send(1);
+	Expect(1, static_cast<int>(Tasks.Tick()));
+	Expect(0, static_cast<int>(Tasks.Num()));
+}
+
 void RunTest_50()
 {
 	Log("TEST await future");
@@ -198,6 +592,109 @@ void RunTest_50()
 	Expect(EStatus::Done, t.Status());
 }
 
+void RunTest_51()
+{
+	Log("TEST await OneShot");
+
+	std::pair<OneShot<int>, OneShotSender<int>> Channel = MakeOneShot<int>();
+	ReadyQueue Queue;
+	UniqueTask<int> t = [&]() -> UniqueTask<int>
+	{
+		const std::optional<int> Val = co_await Channel.first;
+		co_return Val.value_or(-1);
+	}();
+	Queue.Add(t);
+	Expect(1, static_cast<int>(Queue.Drain()));
+	Expect(EStatus::Suspended, t.Status());
+	// Waits for the sender, not polled
+	Expect(0, static_cast<int>(Queue.Drain()));
+	std::thread([Sender = std::move(Channel.second)]() mutable { Sender.Send(5); }).join();
+	Expect(1, static_cast<int>(Queue.Drain()));
+	Expect(EStatus::Done, t.Status());
+	Expect(5, t.Consume().value_or(-1));
+
+	// Inline state, sender released without a value
+	OneShotState<int> State;
+	{
+		std::pair<OneShot<int>, OneShotSender<int>> Inline = State.Connect();
+		UniqueTask<int> t2 = [&]() -> UniqueTask<int>
+		{
+			const std::optional<int> Val = co_await Inline.first;
+			co_return Val.value_or(-1);
+		}();
+		t2.Resume();
+		Expect(EStatus::Suspended, t2.Status());
+		Inline.second.Reset();
+		t2.Resume();
+		Expect(EStatus::Done, t2.Status());
+		Expect(-1, t2.Consume().value_or(-2));
+	}
+}
+
+void RunTest_52()
+{
+	Log("TEST AtomicSharedTask");
+
+	std::atomic<int> Runs = 0;
+	auto Decode = [](std::atomic<int>& Runs) -> AtomicSharedTask<std::vector<int>>
+	{
+		Runs++;
+		co_await std::suspend_always{};
+		co_await std::suspend_always{};
+		co_return std::vector<int>(1000, 7);
+	};
+	auto Reader = [](AtomicSharedTask<std::vector<int>> Shared, std::atomic<int>& Sum) -> UniqueTask<>
+	{
+		const std::optional<std::vector<int>>& Result = co_await Shared;
+		Sum += Result ? Result->at(0) : -1000;
+	};
+
+	// Claiming task is destroyed, the next awaiter continues the frame
+	{
+		std::atomic<int> Sum = 0;
+		AtomicSharedTask<std::vector<int>> Shared = Decode(Runs);
+		UniqueTask<> First = Reader(Shared, Sum);
+		UniqueTask<> Second = Reader(Shared, Sum);
+		First.Resume();
+		Second.Resume();
+		First.Reset();
+		Second.Resume();
+		Expect(EStatus::Suspended, Second.Status());
+		Second.Resume();
+		Expect(EStatus::Done, Second.Status());
+		Expect(7, Sum);
+		Expect(1, Runs);
+		Expect(1000, static_cast<int>(Shared.Get().value_or(std::vector<int>{}).size()));
+	}
+
+	// Awaited from several threads, the waiting tasks are parked in their schedulers
+	Runs = 0;
+	std::atomic<int> Sum = 0;
+	AtomicSharedTask<std::vector<int>> Shared = Decode(Runs);
+	std::vector<std::thread> Threads;
+	for (int t = 0; t < 4; t++)
+	{
+		Threads.emplace_back([&]()
+		{
+			Scheduler Tasks;
+			for (int i = 0; i < 25; i++)
+			{
+				Tasks.Spawn(Reader(Shared, Sum));
+			}
+			while (Tasks.Num())
+			{
+				Tasks.Tick();
+			}
+		});
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	Expect(1, Runs);
+	Expect(100 * 7, Sum);
+}
+
 void RunTest_60()
 {
 	Log("TEST yield");
@@ -287,6 +784,62 @@ void RunTest_61()
 	}
 }
 
+struct CopyCounter
+{
+	static inline int Copies = 0;
+	int Value = 0;
+	std::array<char, 256> Payload{};
+
+	CopyCounter(int InValue) : Value(InValue) {}
+	CopyCounter(const CopyCounter& Other) : Value(Other.Value), Payload(Other.Payload) { Copies++; }
+	CopyCounter& operator=(const CopyCounter&) = delete;
+};
+
+void RunTest_62()
+{
+	Log("TEST Generator");
+
+	auto Fibonacci = []() -> Generator<int>
+	{
+		int a = 0;
+		int b = 1;
+		while (true)
+		{
+			co_yield a;
+			b = std::exchange(a, b) + b;
+		}
+	};
+	int Sum = 0;
+	for (int Value : Fibonacci() | std::views::take(10))
+	{
+		Sum += Value;
+	}
+	Expect(88, Sum);
+
+	auto Large = []() -> Generator<CopyCounter, int>
+	{
+		CopyCounter Local(1);
+		co_yield Local;
+		co_yield CopyCounter(2); // The temporary lives in the frame until the next resume
+		co_await std::suspend_always{}; // Iteration resumes over other awaits
+		co_yield CopyCounter(3);
+		co_return 4;
+	};
+	Generator<CopyCounter, int> g = Large();
+	int Expected = 1;
+	for (const CopyCounter& Value : g)
+	{
+		Expect(Expected++, Value.Value);
+	}
+	Expect(4, Expected);
+	Expect(0, CopyCounter::Copies);
+	Expect(EStatus::Done, g.Status());
+	Expect(4, g.Consume().value_or(-1));
+
+	static_assert(std::ranges::input_range<Generator<int>>);
+	static_assert(std::ranges::view<Generator<int>>);
+}
+
 void RunTest_70()
 {
 	Log("TEST SharedTask");
@@ -360,20 +913,1085 @@ void RunTest_81()
 	Log("Done");
 }
 
+template <typename TaskType>
+std::chrono::nanoseconds CreateResumeDestroy(int Num)
+{
+	const auto Start = std::chrono::steady_clock::now();
+	for (int i = 0; i < Num; i++)
+	{
+		TaskType t = []() -> TaskType 
+		{ 
+			co_await std::suspend_always{}; 
+			co_return 1;
+		}();
+		t.Resume();
+		t.Resume();
+		Expect(EStatus::Done, t.Status());
+	}
+	return std::chrono::steady_clock::now() - Start;
+}
+
+void RunTest_83()
+{
+	Log("TEST Delay");
+
+	// The wheel starts in the future, so the deadlines are not reached by the real clock
+	const TimerWheel::Clock::time_point Start = TimerWheel::Clock::now() + 1h;
+	TimerWheel Timers(10ms, Start);
+	ReadyQueue Queue;
+	const std::array<TimerWheel::Clock::duration, 10> Offsets = { 10ms, 630ms, 640ms, 1s, 40950ms, 40960ms, 50s, 5min, 5h, 24h * 150 };
+	int Fired = 0;
+	std::vector<UniqueTask<>> Sleepers;
+	{
+		TimerWheel::Scope Scope(Timers);
+		for (TimerWheel::Clock::duration Offset : Offsets)
+		{
+			Sleepers.push_back([](TimerWheel::Clock::time_point Deadline, int& Fired) -> UniqueTask<>
+			{
+				co_await Until(Deadline);
+				Fired++;
+			}(Start + Offset, Fired));
+			Queue.Add(Sleepers.back());
+		}
+		Expect(static_cast<int>(Offsets.size()), static_cast<int>(Queue.Drain()));
+	}
+	Expect(static_cast<int>(Offsets.size()), static_cast<int>(Timers.Num()));
+	for (int i = 0; i < static_cast<int>(Offsets.size()); i++)
+	{
+		Timers.Advance(Start + Offsets[i] - 1ms);
+		Expect(0, static_cast<int>(Queue.Drain()));
+		Expect(i, Fired);
+		Expect(1, static_cast<int>(Timers.Advance(Start + Offsets[i])));
+		Expect(1, static_cast<int>(Queue.Drain()));
+		Expect(i + 1, Fired);
+	}
+	Expect(0, static_cast<int>(Timers.Num()));
+
+	// Sleeping tasks are parked by the scheduler
+	Scheduler Tasks;
+	int Early = 0;
+	for (int i = 0; i < 40000; i++)
+	{
+		Tasks.Spawn([](TimerWheel::Clock::duration Duration, int& Early) -> UniqueTask<>
+		{
+			const TimerWheel::Clock::time_point Deadline = TimerWheel::Clock::now() + Duration;
+			co_await Delay(Duration);
+			Early += TimerWheel::Clock::now() < Deadline;
+		}(std::chrono::milliseconds(1 + (i * 7919) % 50), Early));
+	}
+	Expect(40000, static_cast<int>(Tasks.Tick()));
+	// A preempted task may find its deadline already passed
+	const uint32_t Parked = Tasks.NumWaiting();
+	Expect(1, Parked > 39000);
+	uint32_t Resumed = 0;
+	while (Tasks.Num())
+	{
+		Resumed += Tasks.Tick();
+		std::this_thread::sleep_for(1ms);
+	}
+	// Each parked task is resumed once, when its timer expires
+	Expect(static_cast<int>(Parked), static_cast<int>(Resumed));
+	Expect(0, Early);
+
+	// Wake-ups of a single timer tick are not limited by the 16-bit queue counters
+	constexpr int kBurst = 100000;
+	TimerWheel::Clock::time_point Deadline;
+	int Woken = 0;
+	for (int i = 0; i < kBurst; i++)
+	{
+		Tasks.Spawn([](const TimerWheel::Clock::time_point& Deadline, int& Woken) -> UniqueTask<>
+		{
+			co_await Until(Deadline);
+			Woken++;
+		}(Deadline, Woken));
+	}
+	Deadline = TimerWheel::Clock::now() + 100ms;
+	Expect(kBurst, static_cast<int>(Tasks.Tick()));
+	Expect(kBurst, static_cast<int>(Tasks.NumWaiting()));
+	while (Tasks.Num())
+	{
+		Tasks.Tick();
+		std::this_thread::sleep_for(1ms);
+	}
+	Expect(kBurst, Woken);
+}
+
+void RunTest_90()
+{
+	Log("TEST pooled frames");
+
+	constexpr int kNum = 100000;
+	FramePool::ResetStats();
+	const auto Pooled = CreateResumeDestroy<PooledTask>(kNum);
+	const FramePool::Stats Stats = FramePool::GetStats();
+	Expect(kNum, static_cast<int>(Stats.Hits + Stats.Misses));
+	Expect(1, static_cast<int>(Stats.Misses));
+
+	// Not opted in, the counters stay untouched
+	const auto Global = CreateResumeDestroy<UniqueTask<int>>(kNum);
+	Expect(static_cast<int>(Stats.Misses), static_cast<int>(FramePool::GetStats().Misses));
+
+	Log("pooled: ", Pooled.count() / kNum, "ns global: ", Global.count() / kNum, "ns hits: ", Stats.Hits, " misses: ", Stats.Misses);
+	FramePool::Trim();
+}
+
+void RunTest_82()
+{
+	Log("TEST Async wake-up");
+
+	ReadyQueue Queue;
+	UniqueTask<int> t = [&]() -> UniqueTask<int>
+	{
+		std::optional<int> A = co_await Async([]() -> int
+			{
+				std::this_thread::sleep_for(100ms);
+				return 1;
+			});
+		// Nested task reports to the same queue
+		std::optional<int> B = co_await[]() -> UniqueTask<int>
+		{
+			std::optional<int> Result = co_await Async([]() -> int
+				{
+					std::this_thread::sleep_for(100ms);
+					return 2;
+				});
+			co_return Result.value_or(-1);
+		}();
+		co_return A.value_or(-1) + B.value_or(-1);
+	}();
+	Queue.Add(t);
+
+	int Resumed = 0;
+	while (t.Status() == EStatus::Suspended)
+	{
+		Resumed += Queue.Drain();
+		std::this_thread::sleep_for(10ms);
+	}
+	// Start, after the first Async, after the second Async
+	Expect(3, Resumed);
+	Expect(0, static_cast<int>(Queue.Num()));
+	Expect(3, t.Consume().value_or(-1));
+}
+
+void RunTest_91()
+{
+	Log("TEST Scheduler");
+
+	constexpr int kNum = 100000;
+	Scheduler Tasks;
+	int Finished = 0;
+	for (int i = 0; i < kNum; i++)
+	{
+		Tasks.Spawn([](int Suspends, int& OutFinished) -> UniqueTask<>
+		{
+			for (int s = 0; s < Suspends; s++)
+			{
+				co_await std::suspend_always{};
+			}
+			OutFinished++;
+		}(i % 3, Finished));
+	}
+	std::pair<OneShot<int>, OneShotSender<int>> Channel = MakeOneShot<int>();
+	Tasks.Spawn([&]() -> UniqueTask<>
+	{
+		Expect(7, (co_await Channel.first).value_or(-1));
+	}());
+	Expect(kNum + 1, static_cast<int>(Tasks.Num()));
+
+	const auto Start = std::chrono::steady_clock::now();
+	int Ticks = 0;
+	while (Tasks.NumReady())
+	{
+		Tasks.Tick();
+		Ticks++;
+	}
+	const auto Duration = std::chrono::steady_clock::now() - Start;
+	Expect(3, Ticks);
+	Expect(kNum, Finished);
+	Expect(1, static_cast<int>(Tasks.NumWaiting()));
+	Expect(0, static_cast<int>(Tasks.Tick()));
+
+	Channel.second.Send(7);
+	Expect(1, static_cast<int>(Tasks.Tick()));
+	Expect(0, static_cast<int>(Tasks.Num()));
+	Log("ticks: ", Ticks, " ns per resume: ", std::chrono::duration_cast<std::chrono::nanoseconds>(Duration).count() / (2 * kNum));
+
+	// Destroyed with parked tasks, their events fire later
+	std::pair<OneShot<int>, OneShotSender<int>> Late = MakeOneShot<int>();
+	std::atomic<bool> bRelease = false;
+	int Destroyed = 0;
+	auto OnDestroy = [&]() { Destroyed++; };
+	std::thread Releaser;
+	{
+		Scheduler Owner;
+		Owner.Spawn([](OneShot<int> Receiver, auto OnDestroy) -> UniqueTask<>
+		{
+			auto Guard = MakeFnGuard(OnDestroy);
+			co_await Receiver;
+		}(std::move(Late.first), OnDestroy));
+		Owner.Spawn([](std::atomic<bool>& bRelease, auto OnDestroy) -> UniqueTask<>
+		{
+			auto Guard = MakeFnGuard(OnDestroy);
+			co_await Async([&bRelease]()
+				{
+					while (!bRelease.load())
+					{
+						std::this_thread::yield();
+					}
+				});
+		}(bRelease, OnDestroy));
+		Expect(2, static_cast<int>(Owner.Tick()));
+		Expect(2, static_cast<int>(Owner.NumWaiting()));
+		// The call finishes while the scheduler waits for it in the destructor
+		Releaser = std::thread([&]()
+		{
+			std::this_thread::sleep_for(10ms);
+			bRelease.store(true);
+		});
+	}
+	Releaser.join();
+	Expect(2, Destroyed);
+	Late.second.Send(1);
+}
+
+void RunTest_92()
+{
+#if COROUTINE_TRACE
+	Log("TEST trace");
+
+	Trace::Registry::Get().Clear();
+	UniqueTask<int> t = []() -> UniqueTask<int>
+	{
+		co_await std::suspend_always{};
+		std::optional<int> Result = co_await Async([]() -> int { return 3; });
+		co_return Result.value_or(-1);
+	}();
+	t.SetTraceName("Traced");
+	while (t.Status() == EStatus::Suspended)
+	{
+		t.Resume();
+	}
+	Expect(3, t.Consume().value_or(-1));
+
+	std::ostringstream Json;
+	Trace::Registry::Get().WriteChromeJson(Json);
+	const std::string Text = Json.str();
+	Expect(1, Text.find("\"name\":\"Traced\",\"cat\":\"async\"") != std::string::npos);
+	Expect(1, Text.find("\"suspend\":\"done\"") != std::string::npos);
+	Expect(1, Text.find("\"suspend\":\"suspend\"") != std::string::npos);
+	Expect(1, Text.find("\"name\":\"AsyncTask\",\"cat\":\"job\"") != std::string::npos);
+	Expect(1, Text.find("suspended_us") != std::string::npos);
+
+	// The resumed innermost frame of a chain is destroyed by its parent, before the resume returns
+	Trace::Registry::Get().Clear();
+	ChainedTask Inner = []() -> ChainedTask
+	{
+		co_await std::suspend_always{};
+		co_return 4;
+	}();
+	Inner.SetTraceName("Inner");
+	ChainedTask Outer = [](ChainedTask Inner) -> ChainedTask
+	{
+		const std::optional<long> Result = co_await std::move(Inner);
+		co_return Result.value_or(-1) + 1;
+	}(std::move(Inner));
+	Outer.SetTraceName("Outer");
+	Outer.Resume();
+	Expect(EStatus::Suspended, Outer.Status());
+	Outer.Resume();
+	Expect(EStatus::Done, Outer.Status());
+	Expect(5, static_cast<int>(Outer.Consume().value_or(-1)));
+
+	Json.str("");
+	Trace::Registry::Get().WriteChromeJson(Json);
+	const std::string ChainText = Json.str();
+	Expect(1, ChainText.find("\"name\":\"Outer\",\"cat\":\"resume\"") != std::string::npos);
+	Expect(1, ChainText.find("\"name\":\"Inner\",\"cat\":\"resume\"") != std::string::npos);
+	Expect(1, ChainText.find("\"suspend\":\"done\"") != std::string::npos);
+#endif
+}
+
+void RunTest_93()
+{
+	Log("TEST MPMCQueue");
+
+	// Immovable, constructed and consumed in place
+	struct Element
+	{
+		std::atomic<uint32_t> Id;
+		Element(uint32_t InId) : Id(InId) {}
+		Element(const Element&) = delete;
+	};
+
+	// Small ring, so the producers often find it full and the positions wrap many times
+	constexpr uint32_t kThreads = 4;
+	constexpr uint32_t kPerProducer = 50000;
+	MPMCQueue<Element, 16> Queue;
+	std::vector<std::atomic<uint8_t>> Seen(kThreads * kPerProducer);
+	std::atomic<uint32_t> Consumed = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Producer = 0; Producer < kThreads; Producer++)
+	{
+		Threads.emplace_back([&, Producer]()
+		{
+			for (uint32_t Index = 0; Index < kPerProducer; Index++)
+			{
+				Queue.Enqueue(Producer * kPerProducer + Index);
+			}
+		});
+		Threads.emplace_back([&]()
+		{
+			while (Consumed.load(std::memory_order_relaxed) < kThreads * kPerProducer)
+			{
+				std::optional<uint32_t> Id = Queue.Pop([](Element& E) { return E.Id.load(std::memory_order_relaxed); });
+				if (!Id)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				Seen[*Id].fetch_add(1, std::memory_order_relaxed);
+				Consumed.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+	Expect(0, static_cast<int>(Queue.Num()));
+
+	// Full queue refuses the element, without consuming the argument
+	MPMCQueue<std::unique_ptr<int>, 2> Small;
+	std::unique_ptr<int> Value = std::make_unique<int>(1);
+	Expect(1, Small.TryEnqueue(std::make_unique<int>(2)));
+	Expect(1, Small.TryEnqueue(std::make_unique<int>(3)));
+	Expect(0, Small.TryEnqueue(std::move(Value)));
+	Expect(1, !!Value);
+	Expect(2, **Small.Pop());
+	Expect(1, Small.TryEnqueue(std::move(Value)));
+	Expect(3, **Small.Pop());
+	Expect(1, **Small.Pop());
+	Expect(0, Small.Pop().has_value());
+}
+
+void RunTest_94()
+{
+	Log("TEST bulk queue operations");
+
+	// Order across block boundaries, mixed with single operations
+	LockFreeQueue<uint32_t, 16> Queue;
+	uint32_t Pushed = 0;
+	uint32_t Popped = 0;
+	int OutOfOrder = 0;
+	auto Check = [&](uint32_t Value) { OutOfOrder += (Value != Popped++); };
+	for (uint32_t Batch = 0; Batch < 100; Batch++)
+	{
+		Queue.EnqueueBulk(Batch, [&](uint32_t Index) { return Pushed + Index; });
+		Pushed += Batch;
+		Queue.Enqueue(Pushed++);
+		Queue.PopBulk(Batch / 2, Check);
+		Check(Queue.Pop().value_or(~0u));
+	}
+	while (Queue.PopBulk(33, Check)) {}
+	Expect(0, OutOfOrder);
+	Expect(static_cast<int>(Pushed), static_cast<int>(Popped));
+
+	// Concurrent batches
+	constexpr uint32_t kThreads = 4;
+	constexpr uint32_t kBatches = 500;
+	constexpr uint32_t kBatch = 64;
+	LockFreeQueue<uint32_t, 64> Shared;
+	std::vector<std::atomic<uint8_t>> Seen(kThreads * kBatches * kBatch);
+	std::atomic<uint32_t> Consumed = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Producer = 0; Producer < kThreads; Producer++)
+	{
+		Threads.emplace_back([&, Producer]()
+		{
+			for (uint32_t Batch = 0; Batch < kBatches; Batch++)
+			{
+				// The queue counts the elements in 16 bits
+				while (Shared.Num() > 16 * 1024)
+				{
+					std::this_thread::yield();
+				}
+				const uint32_t Base = (Producer * kBatches + Batch) * kBatch;
+				Shared.EnqueueBulk(kBatch, [Base](uint32_t Index) { return Base + Index; });
+			}
+		});
+	}
+	Threads.emplace_back([&]()
+	{
+		while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+		{
+			const uint32_t Num = Shared.PopBulk(kBatch * 2, [&](uint32_t Id) { Seen[Id].fetch_add(1, std::memory_order_relaxed); });
+			Consumed.fetch_add(Num, std::memory_order_relaxed);
+			if (!Num)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+
+	// Batch of calls for the pool
+	constexpr uint32_t kCalls = 16;
+	std::atomic<uint32_t> Called = 0;
+	MultiThread::ThreadPool::Get().PushBulk(kCalls, [&](uint32_t Index)
+	{
+		return MultiThread::AsyncTask([&Called, Index]() { Called.fetch_add(Index + 1); });
+	});
+	while (Called.load() != kCalls * (kCalls + 1) / 2)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void RunTest_95()
+{
+	Log("TEST LockFreeQueue deep backlog");
+
+	constexpr uint32_t kBacklog = 60000;
+	LockFreeQueue<uint32_t, 64> Queue;
+	auto FillAndDrain = [](auto& AnyQueue, uint32_t Num) -> int
+	{
+		for (uint32_t Index = 0; Index < Num; Index++)
+		{
+			AnyQueue.Enqueue(Index);
+		}
+		int OutOfOrder = 0;
+		for (uint32_t Index = 0; Index < Num; Index++)
+		{
+			OutOfOrder += (AnyQueue.Pop().value_or(~0u) != Index);
+		}
+		return OutOfOrder;
+	};
+
+	const auto Start = std::chrono::steady_clock::now();
+	Expect(0, FillAndDrain(Queue, kBacklog));
+	const auto Duration = std::chrono::steady_clock::now() - Start;
+	// The drained blocks are recycled
+	const uint32_t Blocks = Queue.NumAllocatedBlocks();
+	Expect(0, FillAndDrain(Queue, kBacklog));
+	Expect(static_cast<int>(Blocks), static_cast<int>(Queue.NumAllocatedBlocks()));
+	Expect(0, static_cast<int>(Queue.Num()));
+
+	// Wide queue, above the 16-bit count
+	{
+		constexpr uint32_t kWideBacklog = 1200 * 256;
+		LockFreeQueue<uint32_t, 256, 1 << 20> WideQueue;
+		Expect(0, FillAndDrain(WideQueue, kWideBacklog));
+		const uint32_t WideBlocks = WideQueue.NumAllocatedBlocks();
+		Expect(0, FillAndDrain(WideQueue, kWideBacklog));
+		Expect(static_cast<int>(WideBlocks), static_cast<int>(WideQueue.NumAllocatedBlocks()));
+		WideQueue.EnqueueBulk(kWideBacklog, [](uint32_t Index) { return Index; });
+		Expect(static_cast<int>(kWideBacklog), static_cast<int>(WideQueue.Num()));
+		uint32_t Next = 0;
+		int OutOfOrder = 0;
+		while (WideQueue.PopBulk(1000, [&](uint32_t Value) { OutOfOrder += (Value != Next++); })) {}
+		Expect(0, OutOfOrder);
+		Expect(static_cast<int>(kWideBacklog), static_cast<int>(Next));
+	}
+
+	// Many consumers, the queue spans many blocks
+	constexpr uint32_t kThreads = 3;
+	std::vector<std::atomic<uint8_t>> Seen(kThreads * kBacklog);
+	std::atomic<uint32_t> Consumed = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Thread = 0; Thread < kThreads; Thread++)
+	{
+		Threads.emplace_back([&, Thread]()
+		{
+			for (uint32_t Index = 0; Index < kBacklog; Index++)
+			{
+				while (Queue.Num() > kBacklog)
+				{
+					std::this_thread::yield();
+				}
+				Queue.Enqueue(Thread * kBacklog + Index);
+			}
+		});
+		Threads.emplace_back([&]()
+		{
+			while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+			{
+				std::optional<uint32_t> Id = Queue.Pop();
+				if (!Id)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				Seen[*Id].fetch_add(1, std::memory_order_relaxed);
+				Consumed.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+	Log("ns per enqueue and pop: ", std::chrono::duration_cast<std::chrono::nanoseconds>(Duration).count() / kBacklog);
+}
+
+void RunTest_96()
+{
+	Log("TEST LockFreeQueue block trimming");
+
+	constexpr uint32_t kBlocks = 100;
+	LockFreeQueue<uint32_t, 64> Queue;
+	auto Burst = [&]() -> int
+	{
+		for (uint32_t Index = 0; Index < kBlocks * 64; Index++)
+		{
+			Queue.Enqueue(Index);
+		}
+		int OutOfOrder = 0;
+		for (uint32_t Index = 0; Index < kBlocks * 64; Index++)
+		{
+			OutOfOrder += (Queue.Pop().value_or(~0u) != Index);
+		}
+		return OutOfOrder;
+	};
+
+	// Released blocks above the high-water mark are deleted
+	Queue.SetMaxFreeBlocks(4);
+	Expect(0, Burst());
+	Expect(1, Queue.NumAllocatedBlocks() <= 4);
+
+	// Blocks are trimmed after they stayed free for a whole period
+	Queue.SetMaxFreeBlocks(1000);
+	Expect(0, Burst());
+	Expect(1, Queue.NumFreeBlocks() >= kBlocks);
+	Expect(0, static_cast<int>(Queue.TrimIdleBlocks()));
+	Expect(1, Queue.TrimIdleBlocks() >= kBlocks);
+	Expect(0, static_cast<int>(Queue.NumAllocatedBlocks()));
+	Expect(0, Burst());
+
+	// Blocks are recycled and deleted under churn, while other thread trims
+	constexpr uint32_t kThreads = 2;
+	constexpr uint32_t kPerThread = 100000;
+	LockFreeQueue<uint32_t, 16> Churn;
+	Churn.SetMaxFreeBlocks(2);
+	std::vector<std::atomic<uint8_t>> Seen(kThreads * kPerThread);
+	std::atomic<uint32_t> Consumed = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Thread = 0; Thread < kThreads; Thread++)
+	{
+		Threads.emplace_back([&, Thread]()
+		{
+			for (uint32_t Index = 0; Index < kPerThread; Index += 8)
+			{
+				while (Churn.Num() > 1000)
+				{
+					std::this_thread::yield();
+				}
+				Churn.EnqueueBulk(8, [&](uint32_t Offset) { return Thread * kPerThread + Index + Offset; });
+			}
+		});
+		Threads.emplace_back([&]()
+		{
+			while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+			{
+				const uint32_t Num = Churn.PopBulk(5, [&](uint32_t Id) { Seen[Id].fetch_add(1, std::memory_order_relaxed); });
+				if (!Num)
+				{
+					std::this_thread::yield();
+				}
+				Consumed.fetch_add(Num, std::memory_order_relaxed);
+			}
+		});
+	}
+	Threads.emplace_back([&]()
+	{
+		while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+		{
+			Churn.TrimIdleBlocks();
+			Churn.DeleteFreeList();
+			std::this_thread::yield();
+		}
+	});
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+}
+
+using BoundedQueue = LockFreeQueue<uint32_t, 16, 64, true>;
+
+UniqueTask<> ProduceAsync(BoundedQueue& Queue, uint32_t Num)
+{
+	for (uint32_t Index = 0; Index < Num; Index++)
+	{
+		co_await Queue.EnqueueAsync(Index);
+	}
+}
+
+void RunTest_97()
+{
+	Log("TEST LockFreeQueue bounded");
+
+	constexpr uint32_t kCapacity = 64;
+	BoundedQueue Queue;
+	uint32_t Added = 0;
+	while (Queue.TryEnqueue(Added))
+	{
+		Added++;
+	}
+	Expect(kCapacity, Added);
+	Expect(kCapacity, Queue.Num());
+	Expect(0, static_cast<int>(Queue.Pop().value_or(~0u)));
+	Expect(1, Queue.TryEnqueue(Added));
+	Expect(0, Queue.TryEnqueue(Added + 1));
+	while (Queue.Pop()) {}
+
+	// The task is suspended while the queue is full
+	UniqueTask<> Producer = ProduceAsync(Queue, 200);
+	Producer.Resume();
+	Expect(EStatus::Suspended, Producer.Status());
+	Expect(kCapacity, Queue.Num());
+	int OutOfOrder = 0;
+	uint32_t Next = 0;
+	while (Producer.Status() == EStatus::Suspended || Queue.Num())
+	{
+		Queue.PopBulk(10, [&](uint32_t Value) { OutOfOrder += (Value != Next++); });
+		Producer.Resume();
+	}
+	Expect(0, OutOfOrder);
+	Expect(200, static_cast<int>(Next));
+	Expect(EStatus::Done, Producer.Status());
+
+	// Blocked producers are woken by consumers, memory stays fixed
+	constexpr uint32_t kThreads = 3;
+	constexpr uint32_t kPerThread = 50000;
+	std::vector<std::atomic<uint8_t>> Seen(kThreads * kPerThread);
+	std::atomic<uint32_t> Consumed = 0;
+	std::atomic<uint32_t> MaxNum = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Thread = 0; Thread < kThreads; Thread++)
+	{
+		Threads.emplace_back([&, Thread]()
+		{
+			for (uint32_t Index = 0; Index < kPerThread; Index += 4)
+			{
+				if (Index % 8)
+				{
+					Queue.Enqueue(Thread * kPerThread + Index);
+					Queue.EnqueueBulk(3, [&](uint32_t Offset) { return Thread * kPerThread + Index + Offset + 1; });
+				}
+				else
+				{
+					Queue.EnqueueBulk(4, [&](uint32_t Offset) { return Thread * kPerThread + Index + Offset; });
+				}
+				const uint32_t Num = Queue.Num();
+				for (uint32_t Max = MaxNum.load(); Num > Max && !MaxNum.compare_exchange_weak(Max, Num);) {}
+			}
+		});
+		Threads.emplace_back([&]()
+		{
+			while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+			{
+				std::optional<uint32_t> Id = Queue.Pop();
+				if (!Id)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				Seen[*Id].fetch_add(1, std::memory_order_relaxed);
+				Consumed.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+	Expect(1, MaxNum.load() <= kCapacity);
+	// Blocks in the directory (8 entries) and the same number of free ones
+	Expect(1, Queue.NumAllocatedBlocks() <= 16);
+}
+
+void RunTest_98()
+{
+	Log("TEST LockFreeQueue padded layout");
+
+	static_assert(alignof(PaddedLockFreeQueue<uint32_t, 16>) >= 64);
+
+	PaddedLockFreeQueue<uint32_t, 16> Queue;
+	Queue.EnqueueBulk(100, [](uint32_t Index) { return Index; });
+	int OutOfOrder = 0;
+	for (uint32_t Index = 0; Index < 100; Index++)
+	{
+		OutOfOrder += (Queue.Pop().value_or(~0u) != Index);
+	}
+	Expect(0, OutOfOrder);
+
+	// Producers and consumers on neighbouring slots
+	constexpr uint32_t kThreads = 4;
+	constexpr uint32_t kPerThread = 50000;
+	auto Run = [&](auto& AnyQueue) -> int
+	{
+		std::vector<std::atomic<uint8_t>> Seen(kThreads * kPerThread);
+		std::atomic<uint32_t> Consumed = 0;
+		std::vector<std::thread> Threads;
+		for (uint32_t Thread = 0; Thread < kThreads; Thread++)
+		{
+			Threads.emplace_back([&, Thread]()
+			{
+				for (uint32_t Index = 0; Index < kPerThread; Index++)
+				{
+					while (AnyQueue.Num() > 1000)
+					{
+						std::this_thread::yield();
+					}
+					AnyQueue.Enqueue(Thread * kPerThread + Index);
+				}
+			});
+			Threads.emplace_back([&]()
+			{
+				while (Consumed.load(std::memory_order_relaxed) < Seen.size())
+				{
+					const uint32_t Num = AnyQueue.PopBulk(3, [&](uint32_t Id) { Seen[Id].fetch_add(1, std::memory_order_relaxed); });
+					if (!Num)
+					{
+						std::this_thread::yield();
+					}
+					Consumed.fetch_add(Num, std::memory_order_relaxed);
+				}
+			});
+		}
+		for (std::thread& Thread : Threads)
+		{
+			Thread.join();
+		}
+		int Wrong = 0;
+		for (std::atomic<uint8_t>& Count : Seen)
+		{
+			Wrong += (Count.load() != 1);
+		}
+		return Wrong;
+	};
+	Expect(0, Run(Queue));
+	auto Wide = std::make_unique<PaddedLockFreeQueue<uint32_t, 64, 1 << 20>>();
+	Expect(0, Run(*Wide));
+	PaddedLockFreeQueue<uint32_t, 16, 256, true> Bounded;
+	Expect(0, Run(Bounded));
+}
+
+void RunTest_99()
+{
+	Log("TEST blocking consumers");
+
+	using namespace std::chrono_literals;
+	using Clock = std::chrono::steady_clock;
+
+	LockFreeQueue<uint32_t, 16> Queue;
+	Clock::time_point Start = Clock::now();
+	Expect(0, Queue.PopFor(20ms).has_value());
+	Expect(1, Clock::now() - Start >= 20ms);
+
+	// The sleeping consumer is woken by the producer
+	std::thread Producer([&]()
+	{
+		std::this_thread::sleep_for(10ms);
+		Queue.Enqueue(7u);
+	});
+	Start = Clock::now();
+	Expect(7, static_cast<int>(Queue.PopFor(10s).value_or(0)));
+	Expect(1, Clock::now() - Start < 5s);
+	Producer.join();
+
+	// Consumers sleep between sparse bursts
+	constexpr uint32_t kConsumers = 3;
+	constexpr uint32_t kNum = 3000;
+	std::vector<std::atomic<uint8_t>> Seen(kNum);
+	std::atomic<uint32_t> Consumed = 0;
+	std::vector<std::thread> Threads;
+	for (uint32_t Consumer = 0; Consumer < kConsumers; Consumer++)
+	{
+		Threads.emplace_back([&]()
+		{
+			while (Consumed.load() < kNum)
+			{
+				if (std::optional<uint32_t> Id = Queue.PopFor(1ms))
+				{
+					Seen[*Id].fetch_add(1, std::memory_order_relaxed);
+					Consumed.fetch_add(1);
+				}
+			}
+		});
+	}
+	for (uint32_t Index = 0; Index < kNum; Index++)
+	{
+		if (Index % 100 == 0)
+		{
+			std::this_thread::sleep_for(1ms);
+		}
+		Queue.Enqueue(Index);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+
+	// Parked workers are woken by Push
+	MultiThread::ThreadPool& Pool = MultiThread::ThreadPool::Get();
+	std::this_thread::sleep_for(20ms);
+	std::atomic<int64_t> Latency = -1;
+	Start = Clock::now();
+	Pool.Push([&]() { Latency.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - Start).count()); });
+	while (Latency.load() < 0)
+	{
+		std::this_thread::yield();
+	}
+	Log("ns to wake an idle worker: ", Latency.load());
+}
+
+void RunTest_100()
+{
+	Log("TEST AsyncTask storage");
+
+	MultiThread::ThreadPool& Pool = MultiThread::ThreadPool::Get();
+	std::atomic<int> Sum = 0;
+
+	// Move-only captures, stored in place
+	auto Value = std::make_unique<int>(3);
+	Pool.Push([&Sum, Value = std::move(Value)]() { Sum.fetch_add(*Value); });
+
+	// Captures above the inline capacity are moved to the heap
+	std::array<int, 64> Big{};
+	Big.fill(1);
+	Pool.Push([&Sum, Big]() { for (int Element : Big) { Sum.fetch_add(Element); } });
+
+	// Captures are destroyed with the task
+	auto Shared = std::make_shared<int>(5);
+	std::weak_ptr<int> Observer = Shared;
+	Pool.Push([&Sum, Shared = std::move(Shared)]() { Sum.fetch_add(*Shared); });
+
+	while (Sum.load() != 3 + 64 + 5 || !Observer.expired())
+	{
+		std::this_thread::yield();
+	}
+	Expect(1, Observer.expired());
+
+	// Calls pushing more calls, than fits into the queue
+	struct Spawner
+	{
+		std::atomic<uint32_t>& Leaves;
+		void operator()(uint32_t Depth) const
+		{
+			if (!Depth)
+			{
+				Leaves.fetch_add(1);
+				return;
+			}
+			for (uint32_t Child = 0; Child < 2; Child++)
+			{
+				MultiThread::ThreadPool::Get().Push([Spawn = *this, Depth]() { Spawn(Depth - 1); });
+			}
+		}
+	};
+	constexpr uint32_t kDepth = 12;
+	std::atomic<uint32_t> Leaves = 0;
+	Pool.Push([Spawn = Spawner{ Leaves }]() { Spawn(kDepth); });
+	while (Leaves.load() != (1u << kDepth))
+	{
+		std::this_thread::yield();
+	}
+}
+
+void RunTest_101()
+{
+	Log("TEST work stealing");
+
+	// The owner pushes and pops, while thieves steal
+	constexpr uint32_t kNum = 100000;
+	constexpr uint32_t kThieves = 3;
+	WorkStealingDeque<uint32_t, 64> Deque;
+	std::vector<std::atomic<uint8_t>> Seen(kNum);
+	std::atomic<uint32_t> Consumed = 0;
+	auto Mark = [&](uint32_t& Value) { Seen[Value].fetch_add(1, std::memory_order_relaxed); return true; };
+	std::vector<std::thread> Thieves;
+	for (uint32_t Thief = 0; Thief < kThieves; Thief++)
+	{
+		Thieves.emplace_back([&]()
+		{
+			while (Consumed.load() < kNum)
+			{
+				if (Deque.Steal(Mark))
+				{
+					Consumed.fetch_add(1);
+				}
+			}
+		});
+	}
+	for (uint32_t Index = 0; Index < kNum;)
+	{
+		if (Deque.TryPush(Index))
+		{
+			Index++;
+		}
+		if ((Index % 3 == 0 || Deque.Num() == Deque.Capacity()) && Deque.Pop(Mark))
+		{
+			Consumed.fetch_add(1);
+		}
+	}
+	while (Consumed.load() < kNum)
+	{
+		if (Deque.Pop(Mark))
+		{
+			Consumed.fetch_add(1);
+		}
+	}
+	for (std::thread& Thread : Thieves)
+	{
+		Thread.join();
+	}
+	int Wrong = 0;
+	for (std::atomic<uint8_t>& Count : Seen)
+	{
+		Wrong += (Count.load() != 1);
+	}
+	Expect(0, Wrong);
+
+	// A worker pushing more calls, than fits into its deque
+	constexpr uint32_t kSpawned = 1000;
+	std::atomic<uint32_t> Called = 0;
+	MultiThread::ThreadPool::Get().Push([&Called]()
+	{
+		for (uint32_t Index = 0; Index < kSpawned; Index++)
+		{
+			MultiThread::ThreadPool::Get().Push([&Called]() { Called.fetch_add(1); });
+		}
+	});
+	while (Called.load() != kSpawned)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void RunTest_102()
+{
+	Log("TEST configured pools");
+
+	MultiThread::ThreadPool IoPool({ .NumWorkers = 2 });
+	MultiThread::ThreadPool ComputePool({ .NumWorkers = 3, .bPinWorkers = true, .Cpus = { 0 } });
+	Expect(2, static_cast<int>(IoPool.NumWorkers()));
+	Expect(3, static_cast<int>(ComputePool.NumWorkers()));
+
+	// Calls run only on the workers of their pool
+	std::atomic<int> OnIo = 0;
+	std::atomic<int> OnCompute = 0;
+	for (int Index = 0; Index < 100; Index++)
+	{
+		IoPool.Push([&]() { OnIo.fetch_add(IoPool.IsWorkerThread() && !ComputePool.IsWorkerThread()); });
+		ComputePool.Push([&]() { OnCompute.fetch_add(ComputePool.IsWorkerThread() && !IoPool.IsWorkerThread()); });
+	}
+	while (OnIo.load() + OnCompute.load() < 200)
+	{
+		std::this_thread::yield();
+	}
+	Expect(100, OnIo.load());
+	Expect(100, OnCompute.load());
+
+	// Async executed by the given pool
+	UniqueTask<int> Task = [](MultiThread::ThreadPool& Pool) -> UniqueTask<int>
+	{
+		std::optional<bool> OnPool = co_await Async([&Pool]() { return Pool.IsWorkerThread(); }, Pool);
+		co_return OnPool.value_or(false) ? 1 : 0;
+	}(IoPool);
+	while (Task.Status() == EStatus::Suspended)
+	{
+		std::this_thread::yield();
+		Task.Resume();
+	}
+	Expect(1, Task.Consume().value_or(-1));
+
+	// A worker per CPU of the NUMA node
+	MultiThread::ThreadPool NodePool({ .NumaNode = 0 });
+	Expect(static_cast<int>(MultiThread::GetNumaNodeCpus(0).size()), static_cast<int>(NodePool.NumWorkers()));
+	std::atomic<bool> Called = false;
+	NodePool.Push([&]() { Called.store(true); });
+	while (!Called.load())
+	{
+		std::this_thread::yield();
+	}
+}
+
 int main()
 {
 	RunTest_0();
 	RunTest_10();
 	RunTest_11();
 	RunTest_20();
+	RunTest_21();
 	RunTest_30();
+	RunTest_31();
+	RunTest_32();
 	RunTest_40();
 	RunTest_41();
+	RunTest_42();
 	RunTest_50();
+	RunTest_51();
+	RunTest_52();
 	RunTest_60();
 	RunTest_61();
+	RunTest_62();
 	RunTest_70();
 	RunTest_80();
 	RunTest_81();
+	RunTest_82();
+	RunTest_83();
+	RunTest_90();
+	RunTest_91();
+	RunTest_92();
+	RunTest_93();
+	RunTest_94();
+	RunTest_95();
+	RunTest_96();
+	RunTest_97();
+	RunTest_98();
+	RunTest_99();
+	RunTest_100();
+	RunTest_101();
+	RunTest_102();
 	return 0;
 }
\ No newline at end of file